@@ -32,6 +32,8 @@
 #include <muduo/net/TcpConnection.h>
 #include <muduo/net/EventLoopThread.h>
 
+#include <pioneer/net/frame_decoder.h>
+
 #include "commander.h"
 
 using namespace pioneer;
@@ -69,29 +71,26 @@ private:
    *   total size         cson-header         type      ecat  ecode  [count]      body
    * */
   void on_message(const TcpConnectionPtr& conn, Buffer* buf, muduo::Timestamp) {
-    size_t bytes_received = buf->readableBytes();
-    auto header = reinterpret_cast<const atlas::rpc::request_header*>(buf->peek());
-
-    if (bytes_received < sizeof(header->length) || (int32_t)bytes_received < header->length) {
-      LOG(INFO) << "I will read more data. Read " << bytes_received
-          << " bytes while " << header->length << " bytes expected.";
-      return;
+    try {
+      // there might be several responses in a single read, handle them all
+      pioneer::net::frame_decoder::decode(buf, [](const atlas::rpc::block_owner& block, const char* frame, size_t size) {
+        atlas::rpc::message message(block, frame, size);
+
+        if (!message.empty()) {
+          // invoke built-in dispatchers
+          atlas::rpc::dispatcher_manager::ref().dispatch(message, nullptr);
+        }
+        else {
+          LOG(ERROR) << "bad rpc message!";
+        }
+      });
     }
+    catch (const pioneer::net::net_error& e) {
+      LOG(ERROR) << e.what();
 
-    buf->retrieve(sizeof(atlas::rpc::request_header));
-    std::string rpc_str(buf->peek(), buf->readableBytes());
-
-    atlas::rpc::message message(buf->peek());
-
-    if (!rpc_str.empty()) {
-      // invoke built-in dispatchers
-      atlas::rpc::dispatcher_manager::ref().dispatch(header->fn_id, rpc_str, nullptr);
+      buf->retrieveAll();
+      conn->shutdown();
     }
-    else {
-      LOG(ERROR) << "bad rpc message!";
-    }
-
-    buf->retrieveAll();
   }
 
   EventLoop* _loop;
@@ -8,7 +8,7 @@
 #ifndef PIONEER_CONFIG_H_
 #define PIONEER_CONFIG_H_
 
-#define ATLAS_DEBUG_RPC 1
+#include <cstddef>
 
 const char* PIONEER_MULTIGROUP = "234.1.1.18";
 
@@ -19,5 +19,14 @@ const int PIONEER_REPORT_SERVER_PORT = 9080;
 const int OUTWARD_SERVER_THREADS = 2;
 const int INWARD_SERVER_THREADS = 2;
 const int INWARD_CLIENT_POOL_THREADS = 2;
+const int WORKER_THREADS = 8;
+
+const int HIGH_WATER_MARK = 10000;
+const int OUTWARD_QUOTA = 8000;
+const int INWARD_QUOTA = 8000;
+const int TARGET_SOJOURN_MS = 50;
+
+const size_t MAX_FRAME_SIZE = 64 * 1024 * 1024;
+const size_t MAX_PENDING_BYTES = 64 * 1024;
 
 #endif /* CONFIG_H_ */
@@ -38,6 +38,7 @@
 #include <pioneer/net/net_handlers.h>
 #include <pioneer/net/multicast.h>
 #include <pioneer/net/rpc_clients.h>
+#include <pioneer/system/placement.h>
 
 #include "service/rfc_func.h"
 #include "service/rfc_func.server.ipp"
@@ -76,6 +77,11 @@ void at_signal() {
   if (g_outward_server_base_loop) g_outward_server_base_loop->quit();
 }
 
+// the init callback of the IO threads of a muduo server or client pool
+void place_io_thread(const std::string& name, EventLoop* loop) {
+  system::placement::ref().place_current_thread(name);
+}
+
 void signal_handler(int signal_no) {
   switch (signal_no) {
   case SIGHUP:
@@ -93,10 +99,13 @@ class pioneer_server {
 public:
 
   pioneer_server(int outward_port, int inward_port, int reporter_port,
-      int outward_server_threads, int inward_server_threads, int icp_threads, bool logtostderr) :
+      int outward_server_threads, int inward_server_threads, int icp_threads, int worker_threads, int numa_node,
+      int high_water_mark, int outward_quota, int inward_quota, int target_sojourn_ms, bool logtostderr) :
     _outward_server_address(outward_port), _inward_server_address(inward_port), _report_server_address(reporter_port),
     _outward_server_threads(outward_server_threads), _inward_server_threads(inward_server_threads), _icp_threads(icp_threads),
-    _logtostderr(logtostderr)
+    _worker_threads(worker_threads), _numa_node(numa_node),
+    _high_water_mark(high_water_mark), _outward_quota(outward_quota), _inward_quota(inward_quota),
+    _target_sojourn_ms(target_sojourn_ms), _logtostderr(logtostderr)
   {
   }
 
@@ -120,6 +129,13 @@ public:
 
     install_signal_handlers();
 
+    // pin the threads started from now on
+    init_placement();
+
+    // ****************************** worker threads *******************************
+    init_admission();
+    start_worker_pool();
+
     // ****************************** report server ********************************
     start_report_server();
 
@@ -173,10 +189,44 @@ protected:
     ::signal(SIGINT, &signal_handler); // ctrl-c
   }
 
+  void init_placement() {
+    if (_numa_node == system::placement::no_node) return;
+
+    if (system::placement::ref().configure(_numa_node)) {
+      LOG(INFO) << "the threads are pinned to the cpus of numa node " << _numa_node;
+    }
+  }
+
+  void init_admission() {
+    auto& admission = net::admission_controller::ref();
+
+    admission.set_high_water_mark(_high_water_mark);
+    admission.set_quota(net::admission_controller::outward_traffic, _outward_quota);
+    admission.set_quota(net::admission_controller::inward_traffic, _inward_quota);
+    admission.set_target_sojourn(std::chrono::milliseconds(_target_sojourn_ms));
+
+    LOG(INFO) << "at most " << _high_water_mark << " queued requests, " << _outward_quota << " outward and "
+        << _inward_quota << " inward, shedding beyond " << _target_sojourn_ms << "ms in the queue";
+  }
+
+  void start_worker_pool() {
+    system::worker_pool::ref().set_thread_init([](size_t index) {
+      system::placement::ref().place_current_thread("worker " + std::to_string(index));
+    });
+
+    if (!system::worker_pool::ref().size_controller().resize(_worker_threads)) {
+      LOG(ERROR) << "failed to start " << _worker_threads << " worker threads";
+    }
+
+    LOG(INFO) << system::worker_pool::ref().size() << " worker threads";
+  }
+
   void start_report_server() {
     auto f = [this]() {
       if (g_report_server_base_loop) return;
 
+      system::placement::ref().place_current_thread("report server");
+
       LOG(INFO) << "staring report server, listening at " << _report_server_address.toIpPort().c_str() << "...";
 
       g_report_server_base_loop.reset(new EventLoop);
@@ -198,6 +248,8 @@ protected:
     auto f = [this]() {
       if (g_mcast_server) return;
 
+      system::placement::ref().place_current_thread("mcast server");
+
       LOG(INFO) << "starting mcast server...";
 
       g_mcast_server.reset(new net::mcast_server(PIONEER_MULTIGROUP));
@@ -222,15 +274,17 @@ protected:
     auto f = [this]() {
       if (g_outward_server_base_loop) return;
 
+      system::placement::ref().place_current_thread("outward server");
+
       LOG(INFO) << "starting outward server, listening at " << _outward_server_address.toIpPort().c_str() << "...";
 
       g_outward_server_base_loop.reset(new EventLoop);
       net::outward_server server(g_outward_server_base_loop.get(), _outward_server_address, "outward server");
       server.setThreadNum(_outward_server_threads);
+      server.setThreadInitCallback(boost::bind(place_io_thread, "outward server io", _1));
 
       server.setConnectionCallback(boost::bind(connection_handler::on_outward_server_connection, _1));
       server.setMessageCallback(boost::bind(message_handler::on_outward_server_message, _1, _2, _3));
-      server.setWriteCompleteCallback(boost::bind(connection_handler::on_write_complete<outward_tag>, _1));
 
       server.start();
       g_outward_server_base_loop->loop();
@@ -246,15 +300,17 @@ protected:
     auto f = [this]() {
       if (g_inward_server_base_loop) return;
 
+      system::placement::ref().place_current_thread("inward server");
+
       LOG(INFO) << "starting inner server, listening at " << _inward_server_address.toIpPort().c_str() << "...";
 
       g_inward_server_base_loop.reset(new EventLoop);
       net::inward_server server(g_inward_server_base_loop.get(), _inward_server_address, "inward server");
       server.setThreadNum(_inward_server_threads);
+      server.setThreadInitCallback(boost::bind(place_io_thread, "inward server io", _1));
 
       server.setConnectionCallback(boost::bind(connection_handler::on_inward_server_connection, _1));
       server.setMessageCallback(boost::bind(message_handler::on_inward_server_message, _1, _2, _3));
-      server.setWriteCompleteCallback(boost::bind(connection_handler::on_write_complete<inward_tag>, _1));
 
       server.start();
       g_inward_server_base_loop->loop();
@@ -270,6 +326,8 @@ protected:
     auto f = [this]() {
       LOG(INFO) << "starting inner node client pool service...";
 
+      system::placement::ref().place_current_thread("inward client pool");
+
       auto& tcp_client_pool = net::inward_client_pool::ref();
 
       tcp_client_pool.set_server_port(PIONEER_INWARD_SERVER_PORT); // TODO : parameterize this
@@ -277,7 +335,7 @@ protected:
 
       tcp_client_pool.set_connection_callback(boost::bind(net::connection_handler::on_inward_client_connection, _1));
       tcp_client_pool.set_message_callback(boost::bind(net::message_handler::on_inward_client_message, _1, _2, _3));
-      tcp_client_pool.set_write_complete_callback(boost::bind(net::connection_handler::on_write_complete<net::inward_tag>, _1));
+      tcp_client_pool.set_thread_init_callback(boost::bind(place_io_thread, "inward client pool io", _1));
 
       tcp_client_pool.init();
       tcp_client_pool.start();
@@ -302,6 +360,12 @@ private:
   int _outward_server_threads; // outward server thread number
   int _inward_server_threads; // inner server thread number
   int _icp_threads;  // inner client pool thread number
+  int _worker_threads; // worker thread number
+  int _numa_node; // the numa node to pin the threads to, -1 for none
+  int _high_water_mark; // queued requests at most
+  int _outward_quota; // queued outward requests at most
+  int _inward_quota; // queued inward requests at most
+  int _target_sojourn_ms; // shed the outward requests if they wait longer in the queue
 
   bool _logtostderr;
 
@@ -322,6 +386,14 @@ int main(int argc, char* argv[]) {
       ("outward_server_threads", po::value<int>()->default_value(OUTWARD_SERVER_THREADS), "outward server thread number")
       ("inward_server_threads", po::value<int>()->default_value(INWARD_SERVER_THREADS), "inward server thread number")
       ("icp_threads", po::value<int>()->default_value(INWARD_CLIENT_POOL_THREADS), "inward client pool thread number")
+      ("worker_threads", po::value<int>()->default_value(WORKER_THREADS), "worker thread number")
+      ("numa_node", po::value<int>()->default_value(system::placement::no_node), "pin all the threads to the cpus of the numa node, -1 for none")
+      ("high_water_mark", po::value<int>()->default_value(HIGH_WATER_MARK), "queued requests at most, the others are rejected as busy")
+      ("outward_quota", po::value<int>()->default_value(OUTWARD_QUOTA), "queued outward requests at most")
+      ("inward_quota", po::value<int>()->default_value(INWARD_QUOTA), "queued inward requests at most")
+      ("target_sojourn_ms", po::value<int>()->default_value(TARGET_SOJOURN_MS), "shed the outward requests if they wait longer in the queue")
+      ("max_frame_size", po::value<size_t>()->default_value(MAX_FRAME_SIZE), "the longest RPC frame accepted, in bytes")
+      ("max_pending_bytes", po::value<size_t>()->default_value(MAX_PENDING_BYTES), "flush the coalesced messages of a connection beyond this, in bytes")
       ("logtostderr", po::value<bool>()->default_value(true), "all logs are written to stderr instead of file")
       ;
 
@@ -334,6 +406,9 @@ int main(int argc, char* argv[]) {
     return 0;
   }
 
+  net::frame_decoder::set_max_frame_size(vm["max_frame_size"].as<size_t>());
+  net::outbound_queue::set_max_pending_bytes(vm["max_pending_bytes"].as<size_t>());
+
   // make it a local variable to watch the destruction
   {
     pioneer_server server(
@@ -343,6 +418,12 @@ int main(int argc, char* argv[]) {
         vm["outward_server_threads"].as<int>(),
         vm["inward_server_threads"].as<int>(),
         vm["icp_threads"].as<int>(),
+        vm["worker_threads"].as<int>(),
+        vm["numa_node"].as<int>(),
+        vm["high_water_mark"].as<int>(),
+        vm["outward_quota"].as<int>(),
+        vm["inward_quota"].as<int>(),
+        vm["target_sojourn_ms"].as<int>(),
         vm["logtostderr"].as<bool>());
 
     server.start();
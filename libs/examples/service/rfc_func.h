@@ -63,14 +63,16 @@ namespace pioneer {
       static rpc_result start_udp_test(int rounds, int test_count, int interval, int rest_time, rpc_context c) noexcept;
     };
 
-    ATLAS_REGISTER_REMOTE_FUNC(accumulate, 121);
+    ATLAS_REGISTER_REMOTE_FUNC(rpc_func, accumulate, 121);
 
-    ATLAS_REGISTER_REMOTE_FUNC(announce_inner_node, 104);
-    ATLAS_REGISTER_REMOTE_FUNC(cannounce_inner_node, 105);
+    // the cluster membership goes before the data
+    ATLAS_REGISTER_REMOTE_FUNC_FLAGS(rpc_func, announce_inner_node, 104, atlas::rpc::function_table::high_priority);
+    ATLAS_REGISTER_REMOTE_FUNC_FLAGS(rpc_func, cannounce_inner_node, 105, atlas::rpc::function_table::high_priority);
 
-    ATLAS_REGISTER_REMOTE_FUNC(udp_test_received, 110);
-    ATLAS_REGISTER_REMOTE_FUNC(start_udp_test, 111);
-    ATLAS_REGISTER_REMOTE_FUNC(cstart_udp_test, 112);
+    ATLAS_REGISTER_INLINE_REMOTE_FUNC(rpc_func, udp_test_received, 110);
+    // holds a worker for the whole test
+    ATLAS_REGISTER_REMOTE_FUNC_FLAGS(rpc_func, start_udp_test, 111, atlas::rpc::function_table::low_priority);
+    ATLAS_REGISTER_REMOTE_FUNC(rpc_func, cstart_udp_test, 112);
 
   } // rpc
 } // pioneer
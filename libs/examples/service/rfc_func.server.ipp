@@ -25,6 +25,7 @@
 
 #include <iterator>
 #include <numeric>
+#include <vector>
 
 #include <boost/tokenizer.hpp>
 
@@ -32,12 +33,14 @@
 #include <pioneer/net/net.h>
 #include <pioneer/system/context.h>
 
+#ifdef ATLAS_RPC_COROUTINE
+#include <atlas/rpc/coroutine.h>
+#endif
+
 namespace pioneer {
   namespace rpc {
 
-    using atlas::rpc::rpc_iarchive;
     using atlas::rpc::rpc_context;
-    using atlas::rpc::rf_wrapper;
     using atlas::rpc::async_task;
     using atlas::rpc::rpc_callback_type;
     using atlas::rpc::builtin_rfc;
@@ -68,19 +71,44 @@ namespace pioneer {
       // catalog and every data node connected to the target data node, including himself
       net::inward_client_pool::ref().connect(ip);
 
-      return nullptr;
+      // acknowledge, the callers who do not wait for it get nothing
+      return rpc_result();
     }
 
+#ifdef ATLAS_RPC_COROUTINE
+    // announce the nodes one by one, every node once the previous one is acknowledged
+    atlas::rpc::detached announce_one_by_one(std::vector<string> ips) {
+      for (const auto& ip : ips) {
+        // the acknowledgement may never come back over multicast, do not wait for it long
+        mcast_client client;
+        client.set_timeout(std::chrono::milliseconds(500));
+
+        rpc_result r = co_await atlas::rpc::co_call(client, rpc_func::announce_inner_node, fn_ids::announce_inner_node, ip, nilctx);
+        if (r.err() == atlas::rpc::error_value(atlas::rpc::errc::timeout)) {
+          DLOG(INFO) << "data node " << ip << " is announced, no acknowledgement";
+        }
+        else if (r.err()) {
+          LOG(WARNING) << "failed to announce data node " << ip << ", error " << r.err();
+        }
+      }
+    }
+#endif
+
     rpc_result rpc_func::cannounce_inner_node(const string& ip_list, rpc_context c) noexcept {
       DLOG(INFO) << "announcing data nodes " << ip_list;
 
       boost::char_separator<char> sep(",");
       boost::tokenizer<boost::char_separator<char>> tokens(ip_list, sep);
 
+#ifdef ATLAS_RPC_COROUTINE
+      // returns at the first suspension, the worker is not blocked
+      announce_one_by_one(std::vector<string>(tokens.begin(), tokens.end()));
+#else
       for (const auto& token : tokens) {
         mcast_client client;
         client.call(announce_inner_node, fn_ids::announce_inner_node, token, nilctx);
       }
+#endif
 
       return nullptr;
     }
@@ -125,63 +153,7 @@ namespace pioneer {
       return nullptr;
     }
 
-    // TODO : use meta programming to improve such a complex, ugly code segment
-    class rpc_dispatcher {
-    public:
-
-      static boost::optional<rpc_result> dispatch(int fn_id, const std::string& message, const rpc_context& context) {
-        std::istringstream iss(message);
-        rpc_iarchive ia(iss);
-
-        // LOG(INFO) << "dispatch " << method << " for " << context.session_id() << " from " << context.source_ip();
-
-        switch (fn_id) {
-        case fn_ids::announce_inner_node: {
-          rf_wrapper<decltype(rpc_func::announce_inner_node)> announce_inner_node(rpc_func::announce_inner_node, ia, context);
-          return announce_inner_node();
-        }
-        break;
-        case fn_ids::cannounce_inner_node: {
-          rf_wrapper<decltype(rpc_func::cannounce_inner_node)> cannounce_inner_node(rpc_func::cannounce_inner_node, ia, context);
-          return cannounce_inner_node();
-        }
-        break;
-        case fn_ids::accumulate: {
-          rf_wrapper<decltype(rpc_func::accumulate)> accumulate(rpc_func::accumulate, ia, context);
-          return accumulate();
-        }
-        break;
-        case fn_ids::udp_test_received: {
-          rf_wrapper<decltype(rpc_func::udp_test_received)> udp_test_received(rpc_func::udp_test_received, ia, context);
-          return udp_test_received();
-        }
-        break;
-        case fn_ids::start_udp_test: {
-          rf_wrapper<decltype(rpc_func::start_udp_test)> start_udp_test(rpc_func::start_udp_test, ia, context);
-          return start_udp_test();
-        }
-        break;
-        case fn_ids::cstart_udp_test: {
-          rf_wrapper<decltype(rpc_func::cstart_udp_test)> cstart_udp_test(rpc_func::cstart_udp_test, ia, context);
-          return cstart_udp_test();
-        }
-        break;
-        default:
-          // not be responsible to this rpc
-          return boost::none;
-          // DLOG(INFO) << "no method " << method;
-        break;
-        } // switch
-
-        return boost::none;
-      }
-    };
-
   } // rpc
 } // pioneer
 
-// must be placed outside any namespace due to macro's limitation
-// it might be better to use meta programming technology to implement the registering
-ATLAS_REGISTER_RPC_DISPATCHER(pioneer_main_module, pioneer::rpc::rpc_dispatcher::dispatch);
-
 #endif // RFC_SERVICE_RFC_FUNC_SERVER_H_
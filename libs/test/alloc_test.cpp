@@ -0,0 +1,231 @@
+/*
+ * alloc_test.cpp
+ *
+ *  Created on: Oct 17, 2013
+ *      Author: Vincent Zhang, ivincent.zhang@gmail.com
+ */
+
+/*    Copyright 2011 ~ 2013 Vincent Zhang, ivincent.zhang@gmail.com
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+/*
+ * Counts the heap allocations of an async RPC round trip, in a loopback with no network :
+ *
+ *   message_builder::build -> dispatcher_manager::execute -> async_task_manager::resume
+ *
+ * and fails if a call allocates more than the budget. When a change lowers the numbers, lower the
+ * budget with it, when a change has to raise them, raise it in the same commit, and say why.
+ * */
+
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <string>
+
+#include <atlas/rpc.h>
+
+#ifdef __GLIBC__
+extern "C" {
+  void* __libc_malloc(size_t size);
+  void* __libc_calloc(size_t n, size_t size);
+  void* __libc_realloc(void* p, size_t size);
+  void __libc_free(void* p);
+}
+#endif
+
+/*
+ * The budget of a round trip, checked in. The messages are built into the buffers kept by the
+ * thread, the receivers borrow them as the server borrows it's receive buffer, and the response
+ * of a single call goes straight to the callback, and the timer of a call is cancelled when it
+ * completes, the timer wheel reuses it. So a call allocates nothing, the fraction leaves room
+ * for the containers which grow once in a while.
+ *
+ * Not covered here, and still allocating : the arguments and the results longer than the short
+ * string buffer, a peer address longer than it, and the IO thread of the server, which copies the
+ * peer address and the read batch of every read.
+ * */
+const double max_allocs_per_call = 0.01;
+const double max_bytes_per_call = 16;
+
+const int warm_up_calls = 10000;
+const int measured_calls = 100000;
+
+namespace {
+
+  // only the allocations of the thread running the calls are counted, not the ones of the timeout thread
+  thread_local bool counting = false;
+  thread_local size_t alloc_count = 0;
+  thread_local size_t alloc_bytes = 0;
+
+  void* counted_malloc(size_t size) {
+    if (counting) {
+      ++alloc_count;
+      alloc_bytes += size;
+    }
+
+#ifdef __GLIBC__
+    return __libc_malloc(size);
+#else
+    return std::malloc(size);
+#endif
+  }
+
+  void counted_free(void* p) {
+#ifdef __GLIBC__
+    __libc_free(p);
+#else
+    std::free(p);
+#endif
+  }
+
+} // anonymous
+
+#ifdef __GLIBC__
+// the C allocations, boost and the C library included
+extern "C" {
+  void* malloc(size_t size) { return counted_malloc(size); }
+
+  void* calloc(size_t n, size_t size) {
+    if (counting) {
+      ++alloc_count;
+      alloc_bytes += n * size;
+    }
+
+    return __libc_calloc(n, size);
+  }
+
+  void* realloc(void* p, size_t size) {
+    if (counting) {
+      ++alloc_count;
+      alloc_bytes += size;
+    }
+
+    return __libc_realloc(p, size);
+  }
+
+  void free(void* p) { __libc_free(p); }
+}
+#endif
+
+void* operator new(size_t size) {
+  void* p = counted_malloc(size ? size : 1);
+  if (!p) throw std::bad_alloc();
+  return p;
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+
+void* operator new(size_t size, const std::nothrow_t&) noexcept { return counted_malloc(size ? size : 1); }
+
+void* operator new[](size_t size, const std::nothrow_t&) noexcept { return counted_malloc(size ? size : 1); }
+
+void operator delete(void* p) noexcept { counted_free(p); }
+
+void operator delete[](void* p) noexcept { counted_free(p); }
+
+void operator delete(void* p, size_t) noexcept { counted_free(p); }
+
+void operator delete[](void* p, size_t) noexcept { counted_free(p); }
+
+namespace test {
+
+  using namespace atlas::rpc;
+
+  struct echo_service {
+    static rpc_result echo(int n, const std::string& s, rpc_context c) noexcept {
+      return rpc_result(s);
+    }
+  };
+
+  ATLAS_REGISTER_REMOTE_FUNC(echo_service, echo, 1001);
+
+  // the server side, it sends the responses right back to the client side
+  class response_caller : public remote_caller {
+  public:
+
+    response_caller() : remote_caller(1) {}
+
+  protected:
+
+    virtual void send(const char* msg, size_t size) {
+      message m(block_owner(), msg, size);
+      dispatcher_manager::ref().dispatch(m, nullptr);
+    }
+  };
+
+  // the client side, it executes the requests in place
+  class loopback_caller : public remote_caller {
+  public:
+
+    loopback_caller() : remote_caller(1) {}
+
+  protected:
+
+    virtual void send(const char* msg, size_t size) {
+      message m(block_owner(), msg, size);
+      dispatcher_manager::ref().execute(_responder, m, "127.0.0.1:8630");
+    }
+
+  private:
+
+    response_caller _responder;
+  };
+
+} // test
+
+int main() {
+  using namespace test;
+
+  loopback_caller caller;
+  int done = 0;
+
+  rpc_callback_type cb([&done](const std::string& data, int err, async_task& task) { if (!err) ++done; });
+
+  for (int i = 0; i < warm_up_calls; ++i) {
+    caller.call(echo_service::echo, 1001, cb, 1, std::string("hello"), nilctx);
+  }
+
+  counting = true;
+
+  for (int i = 0; i < measured_calls; ++i) {
+    caller.call(echo_service::echo, 1001, cb, 1, std::string("hello"), nilctx);
+  }
+
+  counting = false;
+
+  double allocs = static_cast<double>(alloc_count) / measured_calls;
+  double bytes = static_cast<double>(alloc_bytes) / measured_calls;
+
+  std::printf("round trip : %.3f allocations, %.1f bytes per call, budget %.2f allocations, %.0f bytes\n",
+      allocs, bytes, max_allocs_per_call, max_bytes_per_call);
+
+  if (done != warm_up_calls + measured_calls) {
+    std::printf("FAILED : %d of %d calls completed\n", done, warm_up_calls + measured_calls);
+    return 1;
+  }
+
+  // a completed call leaves no timer behind
+  if (atlas::rpc::timeout_manager::ref().size() != 0) {
+    std::printf("FAILED : %zu timers left after the calls completed\n", atlas::rpc::timeout_manager::ref().size());
+    return 1;
+  }
+
+  if (allocs > max_allocs_per_call || bytes > max_bytes_per_call) {
+    std::printf("FAILED : the round trip allocates more than the budget\n");
+    return 1;
+  }
+
+  return 0;
+}
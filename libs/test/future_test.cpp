@@ -0,0 +1,143 @@
+/*
+ * future_test.cpp
+ *
+ *  Created on: Oct 17, 2013
+ *      Author: Vincent Zhang, ivincent.zhang@gmail.com
+ */
+
+/*    Copyright 2011 ~ 2013 Vincent Zhang, ivincent.zhang@gmail.com
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+/*
+ * Checks the continuations of basic_future :
+ *
+ * 1) a future with a continuation can still be waited for, the value set by another thread,
+ *    before or after the continuation, reaches both of them,
+ * 2) then() takes a continuation which returns void, and a void future chains on.
+ * */
+
+#include <cstdio>
+#include <atomic>
+#include <thread>
+
+#include <atlas/rpc/future.h>
+
+namespace test {
+
+  using namespace atlas::rpc;
+
+  const int rounds = 10000;
+
+  int failures = 0;
+
+  void check(bool ok, const char* what) {
+    if (ok) return;
+
+    std::printf("FAILED : %s\n", what);
+    ++failures;
+  }
+
+  // the value races with the continuation, and get() waits for it all the same
+  void test_continue_and_wait() {
+    for (int i = 0; i < rounds; ++i) {
+      basic_promise<int> promise;
+      basic_future<int> future = promise.get_future();
+
+      std::atomic<int> continued(0);
+
+      std::thread setter([promise, i]() { promise.set_value(i); });
+
+      basic_future<int> next = future.then([&continued](const int& value) {
+        continued = value + 1;
+        return value * 2;
+      });
+
+      check(future.get() == i, "get() after then()");
+      check(next.get() == i * 2, "get() of the chained future");
+      check(continued == i + 1, "the continuation ran before the chained future was ready");
+
+      setter.join();
+    }
+  }
+
+  // a value set before the continuation runs it at once, in this thread
+  void test_continue_ready() {
+    basic_promise<int> promise;
+    basic_future<int> future = promise.get_future();
+
+    check(promise.set_value(1), "the first value counts");
+    check(!promise.set_value(2), "the second value is ignored");
+
+    std::thread::id ran_in;
+    future.on_ready([&ran_in](const int&) { ran_in = std::this_thread::get_id(); });
+
+    check(ran_in == std::this_thread::get_id(), "a ready future continues in the caller");
+    check(future.get() == 1, "the first value stays");
+  }
+
+  void test_void_continuation() {
+    for (int i = 0; i < rounds; ++i) {
+      basic_promise<int> promise;
+      basic_future<int> future = promise.get_future();
+
+      std::atomic<int> seen(0);
+      std::atomic<int> chained(0);
+
+      basic_future<void> done = future.then([&seen](const int& value) { seen = value; });
+      basic_future<int> after = done.then([&chained, &seen]() {
+        chained = seen + 1;
+        return chained.load();
+      });
+
+      std::thread setter([promise, i]() { promise.set_value(i); });
+
+      done.get();
+      check(seen == i, "the void continuation ran before it's future was ready");
+      check(after.get() == i + 1, "a void future chains on");
+      check(chained == i + 1, "the continuation of the void future ran");
+
+      setter.join();
+    }
+  }
+
+  void test_void_promise() {
+    basic_promise<void> promise;
+    basic_future<void> future = promise.get_future();
+
+    bool ran = false;
+    future.on_ready([&ran]() { ran = true; });
+
+    check(!future.is_ready(), "not ready before set_value()");
+    check(promise.set_value(), "the first call counts");
+    check(!promise.set_value(), "the second call is ignored");
+    check(ran && future.is_ready(), "the void continuation ran");
+  }
+
+} // test
+
+int main() {
+  using namespace test;
+
+  test_continue_and_wait();
+  test_continue_ready();
+  test_void_continuation();
+  test_void_promise();
+
+  if (failures) return 1;
+
+  std::printf("futures : ok\n");
+
+  return 0;
+}
@@ -0,0 +1,129 @@
+/*
+ * session_test.cpp
+ *
+ *  Created on: Oct 17, 2013
+ *      Author: Vincent Zhang, ivincent.zhang@gmail.com
+ */
+
+/*    Copyright 2011 ~ 2013 Vincent Zhang, ivincent.zhang@gmail.com
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+/*
+ * Races the expiry of the sessions against their strands : the sessions expire as soon as they
+ * are idle, and a thread expires them all the time, while the requests of every session are
+ * queued in it's strand. A busy session must stay in the table, so the requests of a session
+ * still run one at a time, in the order they are submitted.
+ * */
+
+#include <cstdio>
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <pioneer/net/request.h>
+
+namespace test {
+
+  using namespace atlas::rpc;
+  using namespace pioneer;
+  using namespace pioneer::net;
+
+  const int session_count = 32;
+  const int requests_per_session = 500;
+
+  struct session_state {
+    session_state() : running(false), last(-1) {}
+
+    std::atomic<bool> running;
+    int last;
+  };
+
+  session_state states[session_count];
+
+  std::atomic<int> executed(0);
+  std::atomic<int> overlapped(0);
+  std::atomic<int> reordered(0);
+
+  struct strand_service {
+    static rpc_result step(int session, int seq, rpc_context c) noexcept {
+      session_state& s = states[session];
+
+      if (s.running.exchange(true)) ++overlapped;
+
+      if (seq != s.last + 1) ++reordered;
+      s.last = seq;
+
+      // give the other strand a chance to show up
+      std::this_thread::yield();
+
+      s.running = false;
+      ++executed;
+
+      return nullptr;
+    }
+  };
+
+  ATLAS_REGISTER_REMOTE_FUNC(strand_service, step, 2001);
+
+} // test
+
+int main() {
+  using namespace test;
+
+  system::worker_pool::ref().size_controller().resize(4);
+
+  auto& sessions = session_manager::ref();
+  sessions.set_max_idle(std::chrono::milliseconds(0));
+
+  std::vector<uuid> ids;
+  for (int i = 0; i < session_count; ++i) ids.push_back(session_id_generator::next());
+
+  std::atomic<bool> stopping(false);
+  std::thread expirer([&sessions, &stopping]() {
+    while (!stopping) {
+      sessions.expire_idle();
+      std::this_thread::yield();
+    }
+  });
+
+  // the IO thread : build the requests, and submit them to the strands of their sessions
+  message_builder builder(1);
+  for (int seq = 0; seq < requests_per_session; ++seq) {
+    for (int i = 0; i < session_count; ++i) {
+      auto msg = std::make_shared<std::string>(builder.build_for(ids[i], strand_service::step, 2001, i, seq, nilctx));
+      request_ptr r = sessions.build_request("127.0.0.1:8630", msg, msg->data(), msg->size());
+
+      admission_controller::ref().admit(admission_controller::control_traffic);
+      r->session()->submit(request::make_task(r, admission_controller::control_traffic), 1);
+    }
+  }
+
+  system::worker_pool::ref().wait();
+
+  stopping = true;
+  expirer.join();
+
+  std::printf("strands : %d requests, %d overlapped, %d out of order, %zu sessions left\n",
+      executed.load(), overlapped.load(), reordered.load(), sessions.size());
+
+  if (executed != session_count * requests_per_session || overlapped || reordered) {
+    std::printf("FAILED : a busy session was dropped, and a second strand ran it's requests\n");
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,170 @@
+/*
+ * admission.h
+ *
+ *  Created on: Oct 17, 2013
+ *      Author: Vincent Zhang, ivincent.zhang@gmail.com
+ */
+
+/*    Copyright 2011 ~ 2013 Vincent Zhang, ivincent.zhang@gmail.com
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef PIONEER_NET_ADMISSION_H_
+#define PIONEER_NET_ADMISSION_H_
+
+#include <cstdint>
+#include <atomic>
+#include <chrono>
+#include <limits>
+
+#include <atlas/singleton.h>
+
+namespace pioneer {
+  namespace net {
+
+    /*
+     * Decides, in the IO thread, whether a request may wait in the worker queue, so a burst
+     * degrades into fast server_busy responses rather than into unbounded latency and memory.
+     *
+     * 1) the whole queue holds at most high_water_mark requests,
+     * 2) the outward and the inward traffic hold at most their quota of them each, so the clients
+     *    can not starve the cluster, and the other way around,
+     * 3) the outward traffic is shed when the requests wait too long : if the shortest time a request
+     *    spent in the queue during an interval is above the target, the queue is not absorbing a
+     *    burst but standing, and the new outward requests are rejected until it drains.
+     *
+     * The control traffic, the responses to our own calls for example, is never rejected.
+     * */
+    class admission_controller : public atlas::singleton<admission_controller> {
+    public:
+
+      enum traffic_class { outward_traffic = 0, inward_traffic, control_traffic, traffic_class_count };
+
+      typedef std::chrono::steady_clock clock_type;
+
+    public:
+
+      admission_controller() :
+        _high_water_mark(10000), _target_sojourn_us(50 * 1000), _interval_us(100 * 1000),
+        _queued(0), _shedding(false), _interval_end(0), _interval_min(std::numeric_limits<int64_t>::max()),
+        _rejected(0)
+      {
+        _quotas[outward_traffic].store(8000);
+        _quotas[inward_traffic].store(8000);
+        _quotas[control_traffic].store(std::numeric_limits<size_t>::max());
+
+        for (auto& q : _class_queued) q = 0;
+      }
+
+      admission_controller(const admission_controller&) = delete;
+      admission_controller& operator=(const admission_controller&) = delete;
+
+    public:
+
+      // the limits can be changed at any time, the IO threads see the new values with their next requests
+
+      void set_high_water_mark(size_t n) { _high_water_mark.store(n, std::memory_order_relaxed); }
+
+      void set_quota(traffic_class c, size_t n) { _quotas[c].store(n, std::memory_order_relaxed); }
+
+      void set_target_sojourn(std::chrono::microseconds target) {
+        _target_sojourn_us.store(target.count(), std::memory_order_relaxed);
+      }
+
+      size_t high_water_mark() const { return _high_water_mark.load(std::memory_order_relaxed); }
+
+      size_t quota(traffic_class c) const { return _quotas[c].load(std::memory_order_relaxed); }
+
+      std::chrono::microseconds target_sojourn() const {
+        return std::chrono::microseconds(_target_sojourn_us.load(std::memory_order_relaxed));
+      }
+
+      // return false if the request must be rejected, otherwise it's counted until it leaves the queue
+      bool admit(traffic_class c) {
+        if (c != control_traffic) {
+          size_t queued = _queued.load(std::memory_order_relaxed);
+
+          // an empty queue is not standing any more
+          if (queued == 0) _shedding.store(false, std::memory_order_relaxed);
+
+          if (queued >= _high_water_mark.load(std::memory_order_relaxed)
+              || _class_queued[c].load(std::memory_order_relaxed) >= _quotas[c].load(std::memory_order_relaxed)
+              || (c == outward_traffic && _shedding.load(std::memory_order_relaxed))) {
+            ++_rejected;
+            return false;
+          }
+        }
+
+        ++_queued;
+        ++_class_queued[c];
+
+        return true;
+      }
+
+      // a worker takes the request out of the queue, it waited sojourn_us microseconds
+      void leave(traffic_class c, int64_t sojourn_us) {
+        --_queued;
+        --_class_queued[c];
+
+        update_sojourn(sojourn_us);
+      }
+
+      static int64_t now_us() {
+        return std::chrono::duration_cast<std::chrono::microseconds>(clock_type::now().time_since_epoch()).count();
+      }
+
+      size_t queued() const { return _queued; }
+
+      size_t rejected() const { return _rejected; }
+
+      bool shedding() const { return _shedding; }
+
+    private:
+
+      void update_sojourn(int64_t sojourn_us) {
+        int64_t min = _interval_min.load(std::memory_order_relaxed);
+        while (sojourn_us < min && !_interval_min.compare_exchange_weak(min, sojourn_us, std::memory_order_relaxed)) {}
+
+        int64_t now = now_us();
+        int64_t end = _interval_end.load(std::memory_order_relaxed);
+        if (now < end) return;
+
+        // a single thread closes the interval
+        if (!_interval_end.compare_exchange_strong(end, now + _interval_us, std::memory_order_relaxed)) return;
+
+        min = _interval_min.exchange(std::numeric_limits<int64_t>::max(), std::memory_order_relaxed);
+        _shedding.store(min > _target_sojourn_us.load(std::memory_order_relaxed), std::memory_order_relaxed);
+      }
+
+    private:
+
+      std::atomic<size_t> _high_water_mark;
+      std::atomic<size_t> _quotas[traffic_class_count];
+      std::atomic<int64_t> _target_sojourn_us;
+      const int64_t _interval_us;
+
+      std::atomic<size_t> _queued;
+      std::atomic<size_t> _class_queued[traffic_class_count];
+
+      std::atomic<bool> _shedding;
+      std::atomic<int64_t> _interval_end;
+      std::atomic<int64_t> _interval_min;
+
+      std::atomic<size_t> _rejected;
+    };
+
+  } // net
+} // pioneer
+
+#endif /* PIONEER_NET_ADMISSION_H_ */
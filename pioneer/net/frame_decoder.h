@@ -0,0 +1,140 @@
+/*
+ * frame_decoder.h
+ *
+ *  Created on: Oct 17, 2013
+ *      Author: Vincent Zhang, ivincent.zhang@gmail.com
+ */
+
+/*    Copyright 2011 ~ 2013 Vincent Zhang, ivincent.zhang@gmail.com
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef PIONEER_NET_FRAME_DECODER_H_
+#define PIONEER_NET_FRAME_DECODER_H_
+
+#include <atomic>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include <atlas/rpc/message.h>
+#include <muduo/net/Buffer.h>
+
+#include <pioneer/net/net_error.h>
+
+namespace pioneer {
+  namespace net {
+
+    namespace mn = muduo::net;
+
+    /*
+     * Splits a TCP byte stream into RPC frames. Every frame starts with a request_header,
+     * and request_header::length is the total size of the frame, including the header.
+     *
+     * A single read may carry several pipelined frames followed by the head of the next one,
+     * so we drain every complete frame and leave the partial tail in the buffer for the next read.
+     * */
+    class frame_decoder {
+    public:
+
+      static const size_t header_size = sizeof(atlas::rpc::request_header);
+
+    public:
+
+      // a longer frame is taken for a corrupted stream, 64M by default
+      static size_t max_frame_size() { return frame_size_limit().load(std::memory_order_relaxed); }
+
+      static void set_max_frame_size(size_t size) { frame_size_limit().store(size, std::memory_order_relaxed); }
+
+      /*
+       * Calls on_frame(const block_owner& block, const char* frame, size_t frame_size) for every
+       * complete frame in the buffer, and returns the number of frames handled.
+       *
+       * The frames are not copied : the buffer storage is handed over to a ref-counted block
+       * and every frame is a slice of it, so a request can hold its frame as long as it needs.
+       * Only the partial tail, if any, is copied back into the connection's buffer.
+       *
+       * throw net_error if the stream is corrupted, the caller should close the connection
+       * */
+      template<typename FrameHandler>
+      static size_t decode(mn::Buffer* buf, FrameHandler on_frame) {
+        size_t readable = buf->readableBytes();
+        size_t complete = 0;
+        size_t count = 0;
+        size_t frame_size = 0;
+
+        while (next_frame(buf->peek() + complete, readable - complete, frame_size)) {
+          complete += frame_size;
+          ++count;
+        }
+
+        if (count == 0) return 0;
+
+        // take over the storage of the receive buffer
+        auto block = std::make_shared<mn::Buffer>();
+        block->swap(*buf);
+
+        const char* p = block->peek();
+        if (complete < readable) {
+          buf->append(p + complete, readable - complete);
+        }
+
+        for (const char* end = p + complete; p < end; p += frame_size) {
+          next_frame(p, end - p, frame_size);
+          on_frame(block, p, frame_size);
+        }
+
+        return count;
+      }
+
+      /*
+       * Check if there is a complete frame at the front of [data, data + size)
+       *
+       * throw net_error if the frame length or the header version is not valid
+       * */
+      static bool next_frame(const char* data, size_t size, size_t& frame_size) {
+        if (size < header_size) return false;
+
+        int32_t length = 0;
+        std::memcpy(&length, data + offsetof(atlas::rpc::request_header, length), sizeof(length));
+
+        if (length < static_cast<int32_t>(header_size) || static_cast<size_t>(length) > max_frame_size()) {
+          throw net_error(make_error_code(errc::bad_request), "bad frame length " + std::to_string(length));
+        }
+
+        int16_t version = 0;
+        std::memcpy(&version, data + offsetof(atlas::rpc::request_header, version), sizeof(version));
+
+        if (version != atlas::rpc::header_version) {
+          throw net_error(make_error_code(errc::bad_request), "unsupported header version " + std::to_string(version));
+        }
+
+        frame_size = static_cast<size_t>(length);
+
+        return frame_size <= size;
+      }
+
+    private:
+
+      static std::atomic<size_t>& frame_size_limit() {
+        static std::atomic<size_t> limit(64 * 1024 * 1024);
+        return limit;
+      }
+    };
+
+  } // net
+} // pioneer
+
+#endif /* PIONEER_NET_FRAME_DECODER_H_ */
@@ -0,0 +1,81 @@
+/*
+ * loop_resumer.h
+ *
+ *  Created on: Oct 17, 2013
+ *      Author: Vincent Zhang, ivincent.zhang@gmail.com
+ */
+
+/*    Copyright 2011 ~ 2013 Vincent Zhang, ivincent.zhang@gmail.com
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef PIONEER_NET_LOOP_RESUMER_H_
+#define PIONEER_NET_LOOP_RESUMER_H_
+
+#include <coroutine>
+
+#include <muduo/net/EventLoop.h>
+
+#include <atlas/rpc/coroutine.h>
+
+#include <pioneer/system/thread_pool.h>
+
+namespace pioneer {
+  namespace net {
+
+    namespace mn = muduo::net;
+
+    namespace detail {
+
+      inline void resume_in_loop(void* context, std::coroutine_handle<> handle) {
+        mn::EventLoop* loop = static_cast<mn::EventLoop*>(context);
+
+        if (loop->isInLoopThread()) handle.resume();
+        // the functor holds a single handle, it's stored in place
+        else loop->queueInLoop([handle]() { handle.resume(); });
+      }
+
+      inline void resume_in_worker(void*, std::coroutine_handle<> handle) {
+        // the functor holds a single handle, it's stored in place, the pool is stopping if it's refused
+        if (!system::worker_pool::ref().schedule([handle]() { handle.resume(); })) handle.resume();
+      }
+
+    } // detail
+
+    /*
+     * Resume the coroutine in a worker, rather than in the IO thread or the timeout thread which
+     * delivers the result, so it may block.
+     * */
+    inline atlas::rpc::resumer worker_resumer() {
+      return atlas::rpc::resumer(&detail::resume_in_worker);
+    }
+
+    /*
+     * Resume the coroutine in the event loop of this thread, if this thread runs one, otherwise
+     * in a worker, see worker_resumer.
+     *
+     * Use it for the coroutines started in an IO thread, such as the ones which touch the
+     * connections, so they never move to another thread.
+     * */
+    inline atlas::rpc::resumer current_loop_resumer() {
+      mn::EventLoop* loop = mn::EventLoop::getEventLoopOfCurrentThread();
+      if (!loop) return worker_resumer();
+
+      return atlas::rpc::resumer(&detail::resume_in_loop, loop);
+    }
+
+  } // net
+} // pioneer
+
+#endif /* PIONEER_NET_LOOP_RESUMER_H_ */
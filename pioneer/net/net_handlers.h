@@ -23,6 +23,9 @@
 #ifndef PIONEER_NET_HANDLERS_H_
 #define PIONEER_NET_HANDLERS_H_
 
+#include <cassert>
+#include <vector>
+
 #include <glog/logging.h>
 #include <glog/stl_logging.h>
 #include <atlas/io/iomanip.h> // put_time
@@ -31,10 +34,14 @@
 #include <muduo/net/http/HttpResponse.h>
 
 #include <pioneer/net/ip.h>
+#include <pioneer/net/frame_decoder.h>
+#include <pioneer/net/outbound.h>
 #include <pioneer/net/request.h>
+#include <pioneer/net/admission.h>
 #include <pioneer/system/status.h>
 #include <pioneer/system/context.h>
 #include <pioneer/system/thread_pool.h>
+#include <pioneer/system/placement.h>
 
 namespace pioneer {
   namespace net {
@@ -63,11 +70,6 @@ namespace pioneer {
         handle_connection(inward_client_connection, conn);
       }
 
-      template<typename pool_tag>
-      static void on_write_complete(const mn::TcpConnectionPtr& conn) {
-        connection_pool<pool_tag>::ref().put(conn);
-      }
-
     private:
 
       static void handle_connection(connection_type type, const mn::TcpConnectionPtr& conn) {
@@ -78,6 +80,11 @@ namespace pioneer {
 
         try_set_local_ip(ip::get_ip_part(local_ip_port));
 
+        if (conn->connected()) {
+          // before the connection is put into a pool and visible to the senders
+          outbound_queue::attach(conn);
+        }
+
         if (type == inward_client_connection) {
           handle_inner_client_connection(conn);
           stat_inward_connection(conn);
@@ -227,25 +234,34 @@ namespace pioneer {
     private:
 
       static void handle_tcp_message(message_type type, const mn::TcpConnectionPtr& conn, mn::Buffer* buf, muduo::Timestamp t) {
-        const char* message = buf->peek();
-        size_t len = buf->readableBytes();
-
-        DLOG(INFO) << "message: " << len << " bytes, "
+        DLOG(INFO) << "message: " << buf->readableBytes() << " bytes, "
             << conn->peerAddress().toIpPort() << " -> " << conn->localAddress().toIpPort();
 
-        const atlas::rpc::request_header* header = reinterpret_cast<const atlas::rpc::request_header*>(buf->peek());
+        std::string source_ip_port = conn->peerAddress().toIpPort();
+        std::vector<request_ptr> batch;
 
-        // TODO : handle TCP stick package problem
+        try {
+          // a read may carry several pipelined frames, the last one might be incomplete,
+          // in which case it stays in the buffer until the rest of it arrives
+          frame_decoder::decode(buf, [&source_ip_port, &batch](const atlas::rpc::block_owner& block,
+              const char* frame, size_t size) {
+            batch.push_back(session_manager::ref().build_request(source_ip_port, block, frame, size));
+          });
+        }
+        catch (const net_error& e) {
+          LOG(ERROR) << e.what() << ", close the connection to " << source_ip_port;
 
-        if (len < sizeof(header->length) || (int32_t)len < header->length) {
-          LOG(INFO) << "i will read more data. read " << len
-              << " bytes while " << header->length << " bytes expected.";
+          buf->retrieveAll();
+          conn->shutdown();
+        }
 
+        if (batch.empty()) {
+          DLOG(INFO) << "i will read more data, " << buf->readableBytes() << " bytes pending";
           return;
         }
 
         try {
-          run_task(conn->peerAddress().toIpPort(), message, len);
+          run_tasks(type, batch);
         }
         catch (const net_error& e) {
           LOG(ERROR) << e.what();
@@ -253,8 +269,6 @@ namespace pioneer {
         catch (...) {
           LOG(ERROR) << "unexpected exception";
         }
-
-        buf->retrieveAll();
       }
 
       static void handle_http_message(const mn::HttpRequest& request, mn::HttpResponse* response) {
@@ -290,11 +304,35 @@ namespace pioneer {
           }
           ss2 << "</ol>";
 
+          admission_controller& admission = admission_controller::ref();
+
+          std::stringstream ss4;
+          ss4 << "<ol>"
+              << "<li>" << "queued requests:" << admission.queued() << "</li>"
+              << "<li>" << "busy rejections:" << admission.rejected() << "</li>"
+              << "<li>" << "shedding:" << (admission.shedding() ? "yes" : "no") << "</li>"
+              << "</ol>";
+
+          std::stringstream ss5;
+          ss5 << "<ol>";
+          for (const auto& n : system::placement::ref().topology()) {
+            ss5 << "<li>" << "numa node " << n.id << ":" << n.cpus.size() << " cpus</li>";
+          }
+          for (const auto& p : system::placement::ref().placements()) {
+            ss5 << "<li>" << p.name << ":";
+            if (p.cpu == system::placement::no_node) ss5 << "not pinned";
+            else ss5 << "cpu " << p.cpu << ", numa node " << p.node;
+            ss5 << "</li>";
+          }
+          ss5 << "</ol>";
+
           std::stringstream ss3;
           ss3 << "<html><head><title>pioneer server status report</title></head>"
               << "<body><h1>pioneer server status report</h1>"
               << ss.str()
               << ss2.str()
+              << ss4.str()
+              << ss5.str()
               << "</body></html>";
 
           system::status::last_check_time = now;
@@ -311,9 +349,56 @@ namespace pioneer {
       }
 
       // build a executable task and put the task into the worker thread pool
+      // the message is copied, since the caller reuses the buffer
       static void run_task(const std::string& source_ip_port, const char* message, size_t len) {
-        auto request = session_manager::ref().build_request(source_ip_port, message, len);
-        system::worker_pool::ref().schedule(std::bind(&request::execute, request));
+        auto block = std::make_shared<std::string>(message, len);
+        run_request(inner_message, session_manager::ref().build_request(source_ip_port, block, block->data(), block->size()));
+      }
+
+      // put all the requests decoded from a single read into the worker thread pool
+      // the requests the queue can not take are answered with server_busy right here in the IO thread
+      static void run_tasks(message_type type, const std::vector<request_ptr>& batch) {
+        for (const auto& request : batch) run_request(type, request);
+      }
+
+      // run the request in place, reject it, or queue it to the strand of it's session
+      static void run_request(message_type type, const request_ptr& request) {
+        // not worth a trip through the worker queue
+        if (atlas::rpc::function_table::is_inline_safe(request->fn_id())) {
+          request->execute();
+          return;
+        }
+
+        // do not waste a worker on the requests nobody waits for
+        if (request->expired()) {
+          request->reject(atlas::rpc::errc::deadline_exceeded);
+          return;
+        }
+
+        admission_controller::traffic_class traffic = traffic_class_of(type, request->fn_id());
+        if (!admission_controller::ref().admit(traffic)) {
+          request->reject(atlas::rpc::errc::server_busy);
+          return;
+        }
+
+        schedule(request, traffic);
+      }
+
+      // the requests of a session run in order, in the strand of the session
+      static void schedule(const request_ptr& request, admission_controller::traffic_class traffic) {
+        auto task = request::make_task(request, traffic);
+        int priority = atlas::rpc::function_table::priority_of(request->fn_id());
+
+        // a request always has a session, running it anywhere but in the strand breaks the order
+        assert(request->session());
+        request->session()->submit(task, priority);
+      }
+
+      // the builtin functions carry the results of our own calls, which are never rejected
+      static admission_controller::traffic_class traffic_class_of(message_type type, int fn_id) {
+        if (fn_id < 0) return admission_controller::control_traffic;
+
+        return type == outer_message ? admission_controller::outward_traffic : admission_controller::inward_traffic;
       }
 
     };
@@ -26,6 +26,8 @@
 #include <string>
 #include <atomic>
 #include <map>
+#include <random>
+#include <unordered_map>
 #include <mutex>
 #include <condition_variable>
 
@@ -33,7 +35,6 @@
 #include <boost/ptr_container/ptr_map.hpp>
 #include <glog/logging.h>
 #include <atlas/singleton.h>
-#include <atlas/container/blocking_concurrent_box.h>
 #include <muduo/net/EventLoop.h>
 #include <muduo/net/EventLoopThreadPool.h>
 #include <muduo/net/TcpClient.h>
@@ -46,13 +47,21 @@ namespace pioneer {
 
     namespace mn = muduo::net;
 
+    /*
+     * Holds the established connections, keyed by the peer's ip:port.
+     *
+     * A connection is shared : any number of threads may send on it at the same time, the outbound
+     * queue of the connection serializes the writes, and responses are matched to their requests
+     * by session id. So a lookup does not remove the connection, and never waits.
+     *
+     * The registry is split into stripes, each guarded by its own mutex, so that senders to
+     * different peers rarely contend.
+     * */
     template<typename pool_tag>
     class connection_pool : public atlas::singleton<connection_pool<pool_tag>> {
     public:
 
-      const uint64_t default_wait_time = 60 * 1000; // 1 minute
-
-      typedef std::map<std::string, mn::TcpConnectionPtr>::const_iterator iterator;
+      static const size_t stripe_count = 16;
 
     private:
 
@@ -60,42 +69,94 @@ namespace pioneer {
       connection_pool(connection_pool&)= delete;
       connection_pool& operator=(const connection_pool&)= delete;
 
+      struct stripe {
+        mutable std::mutex mutex;
+        std::unordered_map<std::string, mn::TcpConnectionPtr> connections;
+      };
+
     public:
 
       // TODO : make it private
-      connection_pool() : _connections(std::chrono::microseconds(default_wait_time)) {}
+      connection_pool() : _size(0) {}
+
+      // get the connection to the peer, the connection stays in the pool
+      mn::TcpConnectionPtr get(const std::string& ip_port) const {
+        const stripe& s = stripe_of(ip_port);
 
-      // take a connection and remove it from the pool
-      mn::TcpConnectionPtr take(const std::string& ip_port) {
-        DLOG(INFO) << "take connection for" << ip_port;
+        std::lock_guard<std::mutex> guard(s.mutex);
+        auto it = s.connections.find(ip_port);
+        if (it == s.connections.end()) return mn::TcpConnectionPtr();
 
-        return *_connections.take(ip_port);
+        return it->second;
       }
 
-      mn::TcpConnectionPtr random_take() { return *_connections.random_take(); }
+      // get any connection in the pool
+      mn::TcpConnectionPtr random_get() const {
+        static thread_local std::minstd_rand generator(std::random_device{}());
+
+        size_t first = generator() % stripe_count;
+        for (size_t i = 0; i < stripe_count; ++i) {
+          const stripe& s = _stripes[(first + i) % stripe_count];
+
+          std::lock_guard<std::mutex> guard(s.mutex);
+          if (s.connections.empty()) continue;
+
+          auto it = s.connections.begin();
+          std::advance(it, generator() % s.connections.size());
+          return it->second;
+        }
+
+        return mn::TcpConnectionPtr();
+      }
 
       void put(const mn::TcpConnectionPtr& conn) {
         auto ip_port = conn->peerAddress().toIpPort();
-        _connections.put(ip_port, conn);
+        stripe& s = stripe_of(ip_port);
+
+        {
+          std::lock_guard<std::mutex> guard(s.mutex);
+          if (s.connections.insert(std::make_pair(ip_port, conn)).second) ++_size;
+          else s.connections[ip_port] = conn;
+        }
 
-        DLOG(INFO) << "put " << ip_port << ", pool size : " << _connections.size();
+        DLOG(INFO) << "put " << ip_port << ", pool size : " << size();
       }
 
       void erase(const std::string& ip_port) {
-        _connections.erase(ip_port);
+        stripe& s = stripe_of(ip_port);
 
-        DLOG(INFO) << "pool size : " << _connections.size();
+        {
+          std::lock_guard<std::mutex> guard(s.mutex);
+          _size -= s.connections.erase(ip_port);
+        }
+
+        DLOG(INFO) << "pool size : " << size();
+      }
+
+      void clear() {
+        for (auto& s : _stripes) {
+          std::lock_guard<std::mutex> guard(s.mutex);
+          _size -= s.connections.size();
+          s.connections.clear();
+        }
       }
 
-      void clear() { _connections.clear(); }
+      bool empty() const { return size() == 0; }
 
-      bool empty() const { return _connections.empty(); }
+      size_t size() const { return _size; }
 
-      size_t size() const { return _connections.size(); }
+    private:
+
+      stripe& stripe_of(const std::string& ip_port) { return _stripes[std::hash<std::string>()(ip_port) % stripe_count]; }
+
+      const stripe& stripe_of(const std::string& ip_port) const {
+        return _stripes[std::hash<std::string>()(ip_port) % stripe_count];
+      }
 
     private:
 
-      atlas::blocking_concurrent_box<std::string, mn::TcpConnectionPtr> _connections;
+      std::atomic<size_t> _size;
+      stripe _stripes[stripe_count];
     };
 
     // we may need several different TCP client pool singletons, so we make it a template
@@ -130,6 +191,9 @@ namespace pioneer {
 
       void set_write_complete_callback(const mn::WriteCompleteCallback& cb) { _on_write_complete = cb; }
 
+      // run in every IO thread of the pool when it starts
+      void set_thread_init_callback(const mn::EventLoopThreadPool::ThreadInitCallback& cb) { _on_thread_init = cb; }
+
       void init() {
         _base_loop = new mn::EventLoop;
 
@@ -139,7 +203,7 @@ namespace pioneer {
       }
 
       void start() {
-        _io_thread_pool->start();
+        _io_thread_pool->start(_on_thread_init);
         _base_loop->loop();
       }
 
@@ -321,6 +385,7 @@ namespace pioneer {
       mn::ConnectionCallback _on_connection;
       mn::MessageCallback _on_message;
       mn::WriteCompleteCallback _on_write_complete;
+      mn::EventLoopThreadPool::ThreadInitCallback _on_thread_init;
 
       mutable std::mutex _tcp_client_pool_mutex;
       tcp_client_container _tcp_client_pool;
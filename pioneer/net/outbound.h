@@ -0,0 +1,156 @@
+/*
+ * outbound.h
+ *
+ *  Created on: Oct 17, 2013
+ *      Author: Vincent Zhang, ivincent.zhang@gmail.com
+ */
+
+/*    Copyright 2011 ~ 2013 Vincent Zhang, ivincent.zhang@gmail.com
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef PIONEER_NET_OUTBOUND_H_
+#define PIONEER_NET_OUTBOUND_H_
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+
+#include <boost/any.hpp>
+#include <boost/bind.hpp>
+#include <glog/logging.h>
+#include <muduo/net/Buffer.h>
+#include <muduo/net/EventLoop.h>
+#include <muduo/net/TcpConnection.h>
+
+namespace pioneer {
+  namespace net {
+
+    namespace mn = muduo::net;
+
+    /*
+     * Coalesces the outbound messages of a connection.
+     *
+     * Messages sent within one event loop tick are appended to a pending buffer, and the first
+     * of them schedules a flush at the end of the tick, so they leave in a single write instead
+     * of one write per message. A sender running on the connection's own loop flushes at once
+     * if the pending bytes exceed max_pending_bytes().
+     *
+     * The queue lives in the connection's context, see attach().
+     * */
+    class outbound_queue : public std::enable_shared_from_this<outbound_queue> {
+    public:
+
+      // 64K by default
+      static size_t max_pending_bytes() { return pending_bytes_limit().load(std::memory_order_relaxed); }
+
+      static void set_max_pending_bytes(size_t size) { pending_bytes_limit().store(size, std::memory_order_relaxed); }
+
+    public:
+
+      outbound_queue() : _flush_scheduled(false) {}
+
+      outbound_queue(const outbound_queue&) = delete;
+      outbound_queue& operator=(const outbound_queue&) = delete;
+
+    public:
+
+      /*
+       * Must be called in the connection's loop, before the connection is visible to other threads
+       * */
+      static void attach(const mn::TcpConnectionPtr& conn) {
+        conn->setContext(std::make_shared<outbound_queue>());
+      }
+
+      /*
+       * Thread safe
+       * */
+      static void send(const mn::TcpConnectionPtr& conn, const char* message, size_t size) {
+        const std::shared_ptr<outbound_queue>* queue = boost::any_cast<std::shared_ptr<outbound_queue>>(&conn->getContext());
+
+        // the connection is not managed by us, no coalescing
+        if (!queue) {
+          conn->send(message, size);
+          return;
+        }
+
+        (*queue)->enqueue(conn, message, size);
+      }
+
+    private:
+
+      void enqueue(const mn::TcpConnectionPtr& conn, const char* message, size_t size) {
+        mn::EventLoop* loop = conn->getLoop();
+        bool schedule = false;
+        bool flush_now = false;
+
+        {
+          std::lock_guard<std::mutex> guard(_mutex);
+
+          _pending.append(message, size);
+
+          if (!_flush_scheduled) {
+            _flush_scheduled = true;
+            schedule = true;
+          }
+
+          flush_now = _pending.readableBytes() >= max_pending_bytes() && loop->isInLoopThread();
+        }
+
+        if (flush_now) flush(conn);
+
+        // the scheduled flush finds nothing to do if we have flushed already
+        if (schedule) loop->queueInLoop(boost::bind(&outbound_queue::flush, shared_from_this(), conn));
+      }
+
+      // run in the connection's loop
+      void flush(const mn::TcpConnectionPtr& conn) {
+        mn::Buffer batch;
+
+        {
+          std::lock_guard<std::mutex> guard(_mutex);
+
+          batch.swap(_pending);
+          _flush_scheduled = false;
+        }
+
+        if (batch.readableBytes() == 0) return;
+
+        if (!conn->connected()) {
+          LOG(WARNING) << "drop " << batch.readableBytes() << " bytes to " << conn->peerAddress().toIpPort()
+              << ", connection is down";
+          return;
+        }
+
+        conn->send(&batch);
+      }
+
+    private:
+
+      static std::atomic<size_t>& pending_bytes_limit() {
+        static std::atomic<size_t> limit(64 * 1024);
+        return limit;
+      }
+
+    private:
+
+      std::mutex _mutex;
+      mn::Buffer _pending;
+      bool _flush_scheduled;
+    };
+
+  } // net
+} // pioneer
+
+#endif /* PIONEER_NET_OUTBOUND_H_ */
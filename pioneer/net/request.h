@@ -25,13 +25,22 @@
 
 #include <string>
 #include <deque>
+#include <list>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <unordered_map>
 
 #include <glog/logging.h>
 #include <boost/uuid/uuid.hpp>
+#include <boost/functional/hash.hpp>
 #include <atlas/rpc.h>
+#include <atlas/object_pool.h>
 
 #include <pioneer/system/context.h>
+#include <pioneer/system/thread_pool.h>
 #include <pioneer/net/ip.h>
+#include <pioneer/net/admission.h>
 #include <pioneer/net/rpc_clients.h>
 
 namespace pioneer {
@@ -61,33 +70,143 @@ namespace pioneer {
     class request {
     public:
 
-      request(const uuid& session_id, const session_ptr& s, const char* msg, size_t msg_size, const string& source_ip_port) :
-          _message(msg, msg_size), _session(s), _source_ip_port(source_ip_port)
+      request(const uuid& session_id, const session_ptr& s, uint64_t generation, const atlas::rpc::block_owner& block,
+          const char* msg, size_t msg_size, const string& source_ip_port) :
+          _next(nullptr), _traffic(admission_controller::control_traffic), _enqueued_us(0),
+          _message(block, msg, msg_size), _session(s), _session_id(session_id), _generation(generation),
+          _source_ip_port(source_ip_port)
       {}
 
+      // the session counts it's requests alive, defined after it
+      ~request();
+
     public:
 
-      session_ptr session() const { return _session.lock(); }
+      // never null, the request holds it's session until it is destroyed
+      const session_ptr& session() const { return _session; }
+
+      int fn_id() const { return _message.header()->fn_id; }
+
+      // nobody is waiting for the result any more
+      bool expired() const { return _message.expired(); }
+
+      // answer the caller with an error, the request is not executed
+      void reject(atlas::rpc::errc ec) noexcept {
+        try {
+          rpc::p2p_client response_client(static_cast<rpc::client_type>(_message.header()->client_id), _source_ip_port);
+          if (!atlas::rpc::dispatcher_manager::ref().reject(response_client, _message, _source_ip_port, ec)) {
+            LOG(WARNING) << "drop request " << fn_id() << " from " << _source_ip_port << " : "
+                << atlas::rpc::error_value(ec) << ", the caller expects no response";
+          }
+        }
+        catch (const std::exception& e) {
+          LOG(ERROR) << "failed to reject request from " << _source_ip_port << " : " << e.what();
+        }
+
+        finish();
+      }
 
       void execute() noexcept {
-        rpc::p2p_client response_client(static_cast<rpc::client_type>(_message.header()->client_id), _source_ip_port);
-        atlas::rpc::dispatcher_manager::ref().execute(response_client, _message, _source_ip_port);
+        // the request might have waited in the queue for too long
+        if (expired()) {
+          DLOG(INFO) << "drop expired request from " << _source_ip_port;
+          reject(atlas::rpc::errc::deadline_exceeded);
+          return;
+        }
+
+        try {
+          rpc::p2p_client response_client(static_cast<rpc::client_type>(_message.header()->client_id), _source_ip_port);
+          atlas::rpc::dispatcher_manager::ref().execute(response_client, _message, _source_ip_port);
+        }
+        catch (const std::exception& e) {
+          LOG(ERROR) << "failed to execute request from " << _source_ip_port << " : " << e.what();
+        }
+
+        finish();
+      }
+
+      /*
+       * The task to execute the request in a worker : a single pointer, which a std::function
+       * stores in place. The request holds itself until the task runs, a task must run once.
+       *
+       * The request must be admitted into the queue with the traffic class.
+       * */
+      struct task {
+        void operator()() const {
+          std::shared_ptr<request> self;
+          std::swap(self, r->_self);
+
+          admission_controller::ref().leave(self->_traffic, admission_controller::now_us() - self->_enqueued_us);
+          self->execute();
+        }
+
+        // answer the caller with an error instead of running the request
+        void reject(atlas::rpc::errc ec) const {
+          std::shared_ptr<request> self;
+          std::swap(self, r->_self);
+
+          admission_controller::ref().leave(self->_traffic, admission_controller::now_us() - self->_enqueued_us);
+          self->reject(ec);
+        }
+
+        request* r;
+      };
+
+      static task make_task(const std::shared_ptr<request>& r, admission_controller::traffic_class traffic) {
+        r->_self = r;
+        r->_traffic = traffic;
+        r->_enqueued_us = admission_controller::now_us();
+
+        return task { r.get() };
       }
 
     private:
 
+      friend class session;
+
+      // give the session back to the session manager, defined after it
+      void finish() noexcept;
+
+    private:
+
+      std::shared_ptr<request> _self;
+      request* _next; // the next request of the session to run
+      admission_controller::traffic_class _traffic;
+      int64_t _enqueued_us;
+
       atlas::rpc::message _message;
-      std::weak_ptr<pioneer::net::session> _session;
+      session_ptr _session;
+      uuid _session_id;
+      uint64_t _generation;
 
       std::string _source_ip_port;
     };
 
     typedef std::shared_ptr<request> request_ptr;
 
+    /*
+     * A session is a strand : it's requests run one after another in the order they arrive, while
+     * the requests of the other sessions run in parallel, so a remote function needs no lock for
+     * the state of it's session. The session takes a worker while it has requests waiting, and
+     * gives it back after strand_batch of them, so a busy session does not hold a worker forever.
+     *
+     * The waiting requests are linked through the requests themselves, a strand costs no allocation.
+     *
+     * A session is busy while a request built by it is alive, queued, running, or on it's way to the
+     * strand : the session manager must not drop it then, or the next request would start a second
+     * strand of the same session.
+     * */
     class session : public std::enable_shared_from_this<session> {
     public:
 
-      session(const uuid& id) : _id(id) { }
+      typedef std::chrono::steady_clock clock_type;
+
+      static const size_t strand_batch = 16;
+
+    public:
+
+      session(const uuid& id) : _id(id), _generation(0), _last_active(now()), _requests(0),
+          _head(nullptr), _tail(nullptr), _running(false), _priority(0) { }
 
       ~session() { }
 
@@ -95,11 +214,122 @@ namespace pioneer {
 
     public:
 
-      void build_request(const char* message, size_t size, const std::string& source_ip_port) {
-        _request.reset(new net::request(_id, shared_from_this(), message, size, source_ip_port));
+      // every request bumps the generation of the session, and refreshes it's last active time,
+      // called with the shard of the session locked
+      request_ptr build_request(const atlas::rpc::block_owner& block, const char* message, size_t size,
+          const std::string& source_ip_port) {
+        uint64_t generation = _generation + 1;
+        request_ptr r = atlas::make_pooled<net::request>(_id, shared_from_this(), generation, block, message, size,
+            source_ip_port);
+
+        // nothing is counted if the request can not be built
+        _generation = generation;
+        _last_active = now();
+        ++_requests;
+
+        return r;
+      }
+
+      // run the task after the requests of the session submitted before it, in a worker of the priority
+      void submit(const request::task& t, int priority) {
+        {
+          std::lock_guard<std::mutex> guard(_mutex);
+
+          t.r->_next = nullptr;
+          if (_tail) _tail->_next = t.r;
+          else _head = t.r;
+          _tail = t.r;
+
+          if (_running) return;
+
+          _running = true;
+          _priority = priority;
+          _self = shared_from_this();
+        }
+
+        schedule();
+      }
+
+      uint64_t generation() const { return _generation; }
+
+      // milliseconds since the last request
+      int64_t idle_time() const { return now() - _last_active; }
+
+      bool busy() const { return _requests.load(std::memory_order_acquire) != 0; }
+
+    private:
+
+      friend class request;
+
+      static int64_t now() {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(clock_type::now().time_since_epoch()).count();
+      }
+
+      // a single pointer, which a std::function stores in place
+      struct strand_task {
+        void operator()() const { s->run(); }
+
+        session* s;
+      };
+
+      // called with the lock held
+      net::request* pop() {
+        net::request* r = _head;
+        if (!r) return nullptr;
+
+        _head = r->_next;
+        if (!_head) _tail = nullptr;
+
+        return r;
       }
 
-      const request_ptr& request() const { return _request; }
+      // the session holds itself while it's scheduled
+      void schedule() {
+        if (system::worker_pool::ref().schedule(strand_task { this }, _priority)) return;
+
+        // the pool is stopping
+        session_ptr self;
+        net::request* r = nullptr;
+
+        std::lock_guard<std::mutex> guard(_mutex);
+        while ((r = pop())) request::task { r }.reject(atlas::rpc::errc::server_busy);
+
+        _running = false;
+        std::swap(self, _self);
+      }
+
+      void run() {
+        session_ptr self;
+        std::swap(self, _self);
+
+        for (size_t i = 0; i < strand_batch; ++i) {
+          net::request* r = nullptr;
+          {
+            std::lock_guard<std::mutex> guard(_mutex);
+            r = pop();
+
+            if (!r) {
+              _running = false;
+              return;
+            }
+          }
+
+          request::task { r }();
+        }
+
+        {
+          std::lock_guard<std::mutex> guard(_mutex);
+          if (!_head) {
+            _running = false;
+            return;
+          }
+
+          _self = std::move(self);
+        }
+
+        // more requests are waiting, they queue up behind the other sessions
+        schedule();
+      }
 
     private:
 
@@ -108,7 +338,17 @@ namespace pioneer {
        * different host
        * */
       uuid _id;
-      request_ptr _request;
+      std::atomic<uint64_t> _generation;
+      std::atomic<int64_t> _last_active;
+      std::atomic<size_t> _requests; // the requests alive
+
+      // the strand
+      std::mutex _mutex;
+      net::request* _head;
+      net::request* _tail;
+      bool _running;
+      int _priority;
+      session_ptr _self;
     };
 
     bool operator<(const session& lhs, const session& rhs) {
@@ -119,89 +359,223 @@ namespace pioneer {
       return lhs.id() == rhs.id();
     }
 
+    /*
+     * The sessions of the requests in progress.
+     *
+     * A session is reclaimed once it's last request completes : a request remembers the generation
+     * of the session it was built with, and the session is erased if no newer request came since.
+     * The sessions whose requests never complete, a multicast which dies in the queue for example,
+     * expire after max_idle(), and each shard holds at most max_sessions / shard_count of them,
+     * the least recently active one is evicted to make room. A busy session is neither expired nor
+     * evicted, a shard full of busy sessions grows beyond it's share.
+     *
+     * Each shard keeps it's sessions in a list, the most recently active first, so the idle ones
+     * are found at the back : a new session expires at most sweep_batch of them, and the eviction
+     * takes the last one, in constant time.
+     *
+     * The table is split into shards, each guarded by its own mutex, so the IO threads rarely
+     * contend.
+     * */
     class session_manager : public atlas::singleton<session_manager> {
+    public:
+
+      static const size_t shard_count = 16;
+      static const size_t max_sessions = 1 << 20;
+      static const int64_t default_max_idle_ms = 60 * 1000;
+
+      // a new session expires at most sweep_batch idle sessions of it's shard
+      static const size_t sweep_batch = 8;
+
     private:
 
       friend class atlas::singleton<session_manager>;
       session_manager(session_manager&)= delete;
       session_manager& operator=(const session_manager&)= delete;
 
+      typedef std::list<session_ptr> session_list;
+
+      struct shard {
+        mutable std::mutex mutex;
+        // the most recently active session first
+        session_list lru;
+        std::unordered_map<uuid, session_list::iterator, boost::hash<uuid>> sessions;
+      };
+
     public:
 
       // TODO : make it private, and allow singleton to access it only
-      session_manager() = default;
+      session_manager() : _size(0), _max_idle_ms(default_max_idle_ms) {}
 
     public:
 
-      const request_ptr& build_request(const std::string& source_ip_port, const char* data, size_t len) {
+      void set_max_idle(std::chrono::milliseconds idle) { _max_idle_ms.store(idle.count()); }
+
+      std::chrono::milliseconds max_idle() const { return std::chrono::milliseconds(_max_idle_ms.load()); }
+
+      // the request refers to [data, data + len) inside the block, the data is not copied
+      request_ptr build_request(const std::string& source_ip_port, const atlas::rpc::block_owner& block,
+          const char* data, size_t len) {
         const uuid& session_id = atlas::rpc::message::get_session_id(data, len);
 
         // DLOG(INFO) << "session : " << session_id;
 
-        session_ptr s;
-        bool found = false;
+        shard& sh = shard_of(session_id);
 
         // critical area
-        {
-          std::lock_guard<std::mutex> guard(_mutex);
-          auto it = _sessions.find(session_id);
-          found = (it != _sessions.end());
+        std::lock_guard<std::mutex> guard(sh.mutex);
+        auto it = sh.sessions.find(session_id);
 
-          if (found) {
-            s = it->second;
-          }
-          else {
-            // there is a session token, but we can not find a session in this node,
-            // this means this is a request from an inner-cluster-client, we should
-            // create one session with the pass-in session id
-            s.reset(new session(session_id));
-            _sessions.insert(std::make_pair(s->id(), s));
-          }
+        session_ptr s;
+        if (it != sh.sessions.end()) {
+          s = *it->second;
+          sh.lru.splice(sh.lru.begin(), sh.lru, it->second);
+        }
+        else {
+          // there is a session token, but we can not find a session in this node,
+          // this means this is a request from an inner-cluster-client, we should
+          // create one session with the pass-in session id
+          make_room(sh);
+
+          s = atlas::make_pooled<session>(session_id);
+          sh.lru.push_front(s);
+          sh.sessions.insert(std::make_pair(s->id(), sh.lru.begin()));
+          ++_size;
         }
 
-        s->build_request(data, len, source_ip_port);
-
-        return s->request();
+        // the session is busy and of a new generation before the lock is released, or reclaim()
+        // or sweep() could drop it while the request is being built
+        return s->build_request(block, data, len, source_ip_port);
       }
 
       session_ptr get(const uuid& session_id) const {
-        std::lock_guard<std::mutex> guard(_mutex);
+        const shard& sh = shard_of(session_id);
+        std::lock_guard<std::mutex> guard(sh.mutex);
 
         session_ptr s;
-        auto it = _sessions.find(session_id);
-        if (it != _sessions.end()) {
-          s = it->second;
+        auto it = sh.sessions.find(session_id);
+        if (it != sh.sessions.end()) {
+          s = *it->second;
         }
 
         return s;
       }
 
       void remove(const uuid& session_id) {
-        std::lock_guard<std::mutex> guard(_mutex);
+        shard& sh = shard_of(session_id);
+        std::lock_guard<std::mutex> guard(sh.mutex);
+
+        auto it = sh.sessions.find(session_id);
+        if (it == sh.sessions.end()) return;
+
+        sh.lru.erase(it->second);
+        sh.sessions.erase(it);
+        --_size;
+      }
+
+      // remove the session if no request came since the one of the generation
+      void reclaim(const uuid& session_id, uint64_t generation) {
+        session_ptr s;
 
-        auto it = _sessions.find(session_id);
-        if(it != _sessions.end()) {
-          // if(it->second->request()->response()->is_cluster_canremove())
-          _sessions.erase(session_id);
+        {
+          shard& sh = shard_of(session_id);
+          std::lock_guard<std::mutex> guard(sh.mutex);
+
+          auto it = sh.sessions.find(session_id);
+          if (it == sh.sessions.end() || (*it->second)->generation() != generation) return;
+
+          // destroy the session out of the lock
+          s = std::move(*it->second);
+          sh.lru.erase(it->second);
+          sh.sessions.erase(it);
+          --_size;
         }
       }
 
-      size_t size() const {
-        std::lock_guard<std::mutex> guard(_mutex);
-        return _sessions.size();
+      // remove the sessions idle for longer than max_idle(), but the busy ones
+      void expire_idle() {
+        for (auto& sh : _shards) {
+          std::lock_guard<std::mutex> guard(sh.mutex);
+          sweep(sh, sh.sessions.size());
+        }
       }
 
+      size_t size() const { return _size; }
+
       void clear() {
-        std::lock_guard<std::mutex> guard(_mutex);
-        _sessions.clear();
+        for (auto& sh : _shards) {
+          std::lock_guard<std::mutex> guard(sh.mutex);
+          _size -= sh.sessions.size();
+          sh.sessions.clear();
+          sh.lru.clear();
+        }
+      }
+
+    private:
+
+      shard& shard_of(const uuid& session_id) { return _shards[boost::hash<uuid>()(session_id) % shard_count]; }
+
+      const shard& shard_of(const uuid& session_id) const {
+        return _shards[boost::hash<uuid>()(session_id) % shard_count];
+      }
+
+      // called with the shard locked, erase the least recently active session
+      void pop_back(shard& sh) {
+        sh.sessions.erase(sh.lru.back()->id());
+        sh.lru.pop_back();
+        --_size;
+      }
+
+      // called with the shard locked, a busy session at the back is as good as active
+      void back_to_front(shard& sh) {
+        sh.lru.splice(sh.lru.begin(), sh.lru, std::prev(sh.lru.end()));
+      }
+
+      // called with the shard locked, expire at most n idle sessions, from the back
+      void sweep(shard& sh, size_t n) {
+        const int64_t max_idle_ms = _max_idle_ms.load(std::memory_order_relaxed);
+
+        for (size_t i = 0; i < n && !sh.lru.empty() && sh.lru.back()->idle_time() > max_idle_ms; ++i) {
+          if (sh.lru.back()->busy()) back_to_front(sh);
+          else pop_back(sh);
+        }
+      }
+
+      // called with the shard locked, before a new session is inserted
+      void make_room(shard& sh) {
+        sweep(sh, sweep_batch);
+
+        if (sh.sessions.size() < max_sessions / shard_count) return;
+
+        // still full, evict the least recently active session which is not busy
+        for (size_t i = 0; i < sweep_batch; ++i) {
+          if (!sh.lru.back()->busy()) {
+            LOG(WARNING) << "too many sessions, evict session " << sh.lru.back()->id();
+
+            pop_back(sh);
+            return;
+          }
+
+          back_to_front(sh);
+        }
+
+        LOG(WARNING) << "too many busy sessions, no session is evicted";
       }
 
     private:
 
-      mutable std::mutex _mutex;
-      std::map<uuid, session_ptr> _sessions;
+      std::atomic<size_t> _size;
+      std::atomic<int64_t> _max_idle_ms;
+      shard _shards[shard_count];
     };
 
+    inline request::~request() {
+      --_session->_requests;
+    }
+
+    inline void request::finish() noexcept {
+      session_manager::ref().reclaim(_session_id, _generation);
+    }
+
   } // db
 } // pioneer
 
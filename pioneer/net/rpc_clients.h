@@ -25,6 +25,7 @@
 
 #include <atlas/rpc/rpc.h>
 #include <pioneer/net/net.h>
+#include <pioneer/net/outbound.h>
 
 namespace pioneer {
   namespace rpc {
@@ -77,11 +78,11 @@ namespace pioneer {
         mn::TcpConnectionPtr conn;
 
         if (!conn && (client_type::inward_client & _client)) {
-          conn = net::inward_connection_pool::ref().take(_ip);
+          conn = net::inward_connection_pool::ref().get(_ip);
         }
 
         if (!conn && (client_type::outward_client & _client)) {
-          conn = net::outward_connection_pool::ref().take(_ip);
+          conn = net::outward_connection_pool::ref().get(_ip);
         }
 
         if (!conn) {
@@ -89,7 +90,7 @@ namespace pioneer {
           return;
         }
 
-        conn->send(message, size);
+        net::outbound_queue::send(conn, message, size);
       }
 
     private:
@@ -112,11 +113,11 @@ namespace pioneer {
         mn::TcpConnectionPtr conn;
 
         if (client_type::inward_client & _client_id) {
-          conn = net::inward_connection_pool::ref().random_take();
+          conn = net::inward_connection_pool::ref().random_get();
         }
 
         if (!conn && (client_type::outward_client & _client_id)) {
-          conn = net::outward_connection_pool::ref().random_take();
+          conn = net::outward_connection_pool::ref().random_get();
         }
 
         if (!conn) {
@@ -124,7 +125,7 @@ namespace pioneer {
           return;
         }
 
-        conn->send(message, size);
+        net::outbound_queue::send(conn, message, size);
       }
 
     private:
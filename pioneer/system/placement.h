@@ -0,0 +1,267 @@
+/*
+ * placement.h
+ *
+ *  Created on: Oct 17, 2013
+ *      Author: Vincent Zhang, ivincent.zhang@gmail.com
+ */
+
+/*    Copyright 2011 ~ 2013 Vincent Zhang, ivincent.zhang@gmail.com
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef PIONEER_SYSTEM_PLACEMENT_H_
+#define PIONEER_SYSTEM_PLACEMENT_H_
+
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+
+#include <cerrno>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <map>
+#include <fstream>
+#include <sstream>
+#include <thread>
+#include <mutex>
+
+#include <glog/logging.h>
+#include <atlas/singleton.h>
+
+namespace pioneer {
+  namespace system {
+
+    /*
+     * Where the threads of the server run : every thread is pinned to a core of a single NUMA
+     * node, the cores are given out round robin in the order the threads start, and the memory
+     * of a thread is taken from the node, so the thread local caches, the object pools and the
+     * buffers of the IO loops are all local, and no cache line bounces between the sockets.
+     *
+     * The topology is read from /sys/devices/system/node, a machine without it is a single node
+     * of all the cores. Only the cores the process is allowed to run on are used.
+     *
+     * Nothing is pinned until a node is configured.
+     * */
+    class placement : public atlas::singleton<placement> {
+    public:
+
+      enum { no_node = -1 };
+
+      struct numa_node {
+        int id;
+        std::vector<int> cpus;
+      };
+
+      // a thread, and where it runs, cpu and node are no_node if the thread is not pinned
+      struct thread_placement {
+        std::string name;
+        int cpu;
+        int node;
+      };
+
+    public:
+
+      placement() : _node(no_node), _next_cpu(0) {
+        load_topology();
+      }
+
+      placement(const placement&) = delete;
+      placement& operator=(const placement&) = delete;
+
+    public:
+
+      // pin the threads started from now on to the cores of the node, or to nothing with no_node
+      bool configure(int node) {
+        std::lock_guard<std::mutex> guard(_mutex);
+
+        if (node == no_node) {
+          _node = no_node;
+          return true;
+        }
+
+        for (const auto& n : _topology) {
+          if (n.id == node && !n.cpus.empty()) {
+            _node = node;
+            _cpus = n.cpus;
+            _next_cpu = 0;
+
+            return true;
+          }
+        }
+
+        LOG(ERROR) << "no usable cpu on numa node " << node << ", the threads are not pinned";
+        return false;
+      }
+
+      // called by a thread when it starts, and again if the placement is reconfigured,
+      // a thread placed again keeps its row, and its cpu if it stays on the same node
+      void place_current_thread(const std::string& name) {
+        const std::thread::id self = std::this_thread::get_id();
+
+        int cpu = no_node;
+        int node = no_node;
+
+        {
+          std::lock_guard<std::mutex> guard(_mutex);
+
+          if (_node != no_node) {
+            auto it = _rows.find(self);
+            if (it != _rows.end() && _placements[it->second].node == _node) {
+              cpu = _placements[it->second].cpu;
+            }
+            else {
+              cpu = _cpus[_next_cpu++ % _cpus.size()];
+            }
+
+            node = _node;
+          }
+        }
+
+        if (node != no_node && !(pin_to_cpu(cpu) && prefer_node(node))) {
+          cpu = node = no_node;
+        }
+
+        std::lock_guard<std::mutex> guard(_mutex);
+
+        auto it = _rows.find(self);
+        if (it != _rows.end()) {
+          _placements[it->second] = thread_placement { name, cpu, node };
+        }
+        else {
+          _rows[self] = _placements.size();
+          _placements.push_back(thread_placement { name, cpu, node });
+        }
+      }
+
+      std::vector<thread_placement> placements() const {
+        std::lock_guard<std::mutex> guard(_mutex);
+        return _placements;
+      }
+
+      const std::vector<numa_node>& topology() const { return _topology; }
+
+      int node() const {
+        std::lock_guard<std::mutex> guard(_mutex);
+        return _node;
+      }
+
+    private:
+
+      void load_topology() {
+        cpu_set_t allowed;
+        CPU_ZERO(&allowed);
+        bool restricted = ::sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+
+        for (int id = 0; ; ++id) {
+          std::ifstream file("/sys/devices/system/node/node" + std::to_string(id) + "/cpulist");
+          if (!file) break;
+
+          std::string cpulist;
+          std::getline(file, cpulist);
+
+          numa_node n { id, std::vector<int>() };
+          for (int cpu : parse_cpulist(cpulist)) {
+            if (!restricted || (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))) n.cpus.push_back(cpu);
+          }
+
+          _topology.push_back(n);
+        }
+
+        if (!_topology.empty()) return;
+
+        numa_node n { 0, std::vector<int>() };
+        for (int cpu = 0; cpu < static_cast<int>(std::thread::hardware_concurrency()); ++cpu) {
+          if (!restricted || CPU_ISSET(cpu, &allowed)) n.cpus.push_back(cpu);
+        }
+
+        _topology.push_back(n);
+      }
+
+      // a list like "0-3,8-11"
+      static std::vector<int> parse_cpulist(const std::string& cpulist) {
+        std::vector<int> cpus;
+
+        std::stringstream ss(cpulist);
+        std::string range;
+        while (std::getline(ss, range, ',')) {
+          if (range.empty()) continue;
+
+          int first = 0, last = 0;
+          size_t dash = range.find('-');
+
+          try {
+            first = std::stoi(range.substr(0, dash));
+            last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+          }
+          catch (const std::exception& e) {
+            LOG(ERROR) << "bad cpu list " << cpulist;
+            return std::vector<int>();
+          }
+
+          for (int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+        }
+
+        return cpus;
+      }
+
+      static bool pin_to_cpu(int cpu) {
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cpu, &set);
+
+        int err = ::pthread_setaffinity_np(::pthread_self(), sizeof(set), &set);
+        if (err) {
+          LOG(ERROR) << "failed to pin the thread to cpu " << cpu << " : " << std::strerror(err);
+          return false;
+        }
+
+        return true;
+      }
+
+      // the memory of the thread comes from the node while it has some, no libnuma needed
+      static bool prefer_node(int node) {
+        const int mpol_preferred = 1;
+        const size_t bits = 8 * sizeof(unsigned long);
+
+        std::vector<unsigned long> mask(node / bits + 1, 0);
+        mask[node / bits] = 1UL << (node % bits);
+
+        if (::syscall(SYS_set_mempolicy, mpol_preferred, mask.data(), mask.size() * bits + 1) != 0) {
+          LOG(ERROR) << "failed to set the memory policy to node " << node << " : " << std::strerror(errno);
+          return false;
+        }
+
+        return true;
+      }
+
+    private:
+
+      std::vector<numa_node> _topology;
+
+      int _node;
+      std::vector<int> _cpus;
+      size_t _next_cpu;
+
+      std::vector<thread_placement> _placements;
+      std::map<std::thread::id, size_t> _rows; // the row of each thread in _placements
+
+      mutable std::mutex _mutex;
+    };
+
+  } // system
+} // pioneer
+
+#endif /* PIONEER_SYSTEM_PLACEMENT_H_ */
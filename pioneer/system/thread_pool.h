@@ -24,12 +24,12 @@
 #define WORKER_THREAD_POOL_H_
 
 #include <atlas/singleton.h>
-#include <atlas/thread_pool.h>
+#include <atlas/work_stealing_pool.h>
 
 namespace pioneer {
   namespace system {
 
-    typedef atlas::singleton<atlas::fifo_thread_pool> worker_pool;
+    typedef atlas::singleton<atlas::work_stealing_pool> worker_pool;
 
   } // net
 } // pioneer
@@ -0,0 +1,212 @@
+/*
+ * lz.h
+ *
+ *  Created on: Oct 17, 2013
+ *      Author: Vincent Zhang, ivincent.zhang@gmail.com
+ */
+
+/*    Copyright 2011 ~ 2013 Vincent Zhang, ivincent.zhang@gmail.com
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef ATLAS_COMPRESS_LZ_H_
+#define ATLAS_COMPRESS_LZ_H_
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <stdexcept>
+
+namespace atlas {
+  namespace lz {
+
+    /*
+     * A fast LZ77 block compressor, in the spirit of LZ4 : a single pass with a small hash table,
+     * no entropy coding. It trades ratio for speed, which is what we need on the wire.
+     *
+     * Block layout :
+     *
+     *   uint32 raw size, then a list of sequences
+     *
+     * Every sequence is
+     *
+     *   token      : high 4 bits literal length, low 4 bits match length - min_match,
+     *                15 means the length goes on with bytes of 255, ended by a byte below 255
+     *   literals   : the literal bytes
+     *   offset     : uint16, backward distance of the match
+     *
+     * The last sequence of a block has literals only, it ends at the end of the block.
+     * */
+
+    class lz_error : public std::runtime_error {
+    public:
+
+      lz_error(const std::string& what) : std::runtime_error(what) {}
+    };
+
+    namespace {
+
+      const size_t min_match = 4;
+      const size_t hash_log = 12;
+      const size_t max_offset = 65535;
+
+      inline uint32_t read32(const char* p) {
+        uint32_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+      }
+
+      inline uint32_t hash32(uint32_t v) { return (v * 2654435761U) >> (32 - hash_log); }
+
+      inline void write_length(std::string& out, size_t len) {
+        while (len >= 255) {
+          out.push_back(static_cast<char>(255));
+          len -= 255;
+        }
+        out.push_back(static_cast<char>(len));
+      }
+
+      inline void write_sequence(std::string& out, const char* literals, size_t literal_len,
+          size_t offset, size_t match_len) {
+        size_t lit_nibble = literal_len < 15 ? literal_len : 15;
+        size_t match_nibble = 0;
+        if (match_len) {
+          match_nibble = match_len - min_match < 15 ? match_len - min_match : 15;
+        }
+
+        out.push_back(static_cast<char>((lit_nibble << 4) | match_nibble));
+        if (lit_nibble == 15) write_length(out, literal_len - 15);
+        out.append(literals, literal_len);
+
+        if (!match_len) return;
+
+        out.push_back(static_cast<char>(offset & 0xff));
+        out.push_back(static_cast<char>(offset >> 8));
+        if (match_nibble == 15) write_length(out, match_len - min_match - 15);
+      }
+
+      // throw lz_error
+      inline size_t read_length(const char*& p, const char* end, size_t len) {
+        if (len != 15) return len;
+
+        uint8_t byte = 0;
+        do {
+          if (p == end) throw lz_error("truncated length");
+          byte = static_cast<uint8_t>(*p++);
+          len += byte;
+        } while (byte == 255);
+
+        return len;
+      }
+
+    } // anonymous
+
+    // the size of a compressed block is never larger than this
+    inline size_t max_compressed_size(size_t size) { return sizeof(uint32_t) + size + size / 255 + 16; }
+
+    // append the compressed form of [src, src + size) to out
+    inline void compress(const char* src, size_t size, std::string& out) {
+      uint32_t raw_size = static_cast<uint32_t>(size);
+      out.reserve(out.size() + max_compressed_size(size));
+      out.append(reinterpret_cast<const char*>(&raw_size), sizeof(raw_size));
+
+      uint32_t table[1 << hash_log];
+      std::memset(table, 0, sizeof(table));
+
+      size_t anchor = 0;
+      size_t i = 0;
+
+      while (i + min_match <= size) {
+        uint32_t v = read32(src + i);
+        uint32_t h = hash32(v);
+        size_t candidate = table[h];
+        table[h] = static_cast<uint32_t>(i);
+
+        if (candidate >= i || i - candidate > max_offset || read32(src + candidate) != v) {
+          // skip faster over data which does not compress
+          i += 1 + ((i - anchor) >> 6);
+          continue;
+        }
+
+        size_t len = min_match;
+        while (i + len < size && src[candidate + len] == src[i + len]) ++len;
+
+        write_sequence(out, src + anchor, i - anchor, i - candidate, len);
+
+        i += len;
+        anchor = i;
+      }
+
+      write_sequence(out, src + anchor, size - anchor, 0, 0);
+    }
+
+    /*
+     * Replace out with the data decompressed from [src, src + size)
+     * throw lz_error if the block is malformed, or larger than max_size once decompressed
+     * */
+    inline void decompress(const char* src, size_t size, std::string& out, size_t max_size) {
+      if (size < sizeof(uint32_t)) throw lz_error("truncated block");
+
+      uint32_t raw_size = read32(src);
+      if (raw_size > max_size) throw lz_error("block too large : " + std::to_string(raw_size));
+
+      out.resize(raw_size);
+      char* const begin = &out[0];
+      char* op = begin;
+      char* const oend = begin + raw_size;
+
+      const char* p = src + sizeof(uint32_t);
+      const char* const end = src + size;
+
+      while (p < end) {
+        uint8_t token = static_cast<uint8_t>(*p++);
+
+        size_t literal_len = read_length(p, end, token >> 4);
+        if (static_cast<size_t>(end - p) < literal_len || static_cast<size_t>(oend - op) < literal_len) {
+          throw lz_error("literals overflow");
+        }
+
+        std::memcpy(op, p, literal_len);
+        op += literal_len;
+        p += literal_len;
+
+        // the last sequence
+        if (p == end) break;
+
+        if (end - p < 2) throw lz_error("truncated offset");
+        size_t offset = static_cast<uint8_t>(p[0]) | (static_cast<size_t>(static_cast<uint8_t>(p[1])) << 8);
+        p += 2;
+
+        size_t match_len = read_length(p, end, token & 0x0f) + min_match;
+        if (offset == 0 || offset > static_cast<size_t>(op - begin)) throw lz_error("bad offset");
+        if (static_cast<size_t>(oend - op) < match_len) throw lz_error("match overflow");
+
+        const char* match = op - offset;
+        if (offset >= match_len) {
+          std::memcpy(op, match, match_len);
+          op += match_len;
+        }
+        else {
+          // overlapped, the match repeats the last offset bytes
+          for (size_t k = 0; k < match_len; ++k) *op++ = *match++;
+        }
+      }
+
+      if (op != oend) throw lz_error("size mismatch");
+    }
+
+  } // lz
+} // atlas
+
+#endif /* ATLAS_COMPRESS_LZ_H_ */
@@ -0,0 +1,56 @@
+/*
+ * memstream.h
+ *
+ *  Created on: Oct 17, 2013
+ *      Author: vincent
+ */
+
+#ifndef ATLAS_IO_MEMSTREAM_H_
+#define ATLAS_IO_MEMSTREAM_H_
+
+#include <cstddef>
+#include <istream>
+#include <streambuf>
+
+namespace atlas {
+
+  // a read only stream buffer over a memory range owned by somebody else,
+  // unlike std::istringstream, nothing is copied
+  class imemstreambuf : public std::streambuf {
+  public:
+
+    imemstreambuf(const char* data, size_t size) {
+      char* p = const_cast<char*>(data);
+      setg(p, p, p + size);
+    }
+
+  protected:
+
+    virtual pos_type seekoff(off_type off, std::ios_base::seekdir dir, std::ios_base::openmode which) {
+      if (!(which & std::ios_base::in)) return pos_type(off_type(-1));
+
+      char* p = nullptr;
+      if (dir == std::ios_base::beg) p = eback() + off;
+      else if (dir == std::ios_base::cur) p = gptr() + off;
+      else p = egptr() + off;
+
+      if (p < eback() || p > egptr()) return pos_type(off_type(-1));
+
+      setg(eback(), p, egptr());
+      return pos_type(p - eback());
+    }
+
+    virtual pos_type seekpos(pos_type pos, std::ios_base::openmode which) {
+      return seekoff(off_type(pos), std::ios_base::beg, which);
+    }
+  };
+
+  class imemstream : private imemstreambuf, public std::istream {
+  public:
+
+    imemstream(const char* data, size_t size) : imemstreambuf(data, size), std::istream(this) {}
+  };
+
+} // atlas
+
+#endif /* ATLAS_IO_MEMSTREAM_H_ */
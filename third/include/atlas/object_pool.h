@@ -0,0 +1,259 @@
+/*
+ * object_pool.h
+ *
+ *  Created on: Oct 17, 2013
+ *      Author: Vincent Zhang, ivincent.zhang@gmail.com
+ */
+
+/*    Copyright 2011 ~ 2013 Vincent Zhang, ivincent.zhang@gmail.com
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef ATLAS_OBJECT_POOL_H_
+#define ATLAS_OBJECT_POOL_H_
+
+#include <cstddef>
+#include <new>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <utility>
+
+namespace atlas {
+
+  namespace detail {
+
+    struct free_block {
+      free_block* next;
+    };
+
+    // a list of free blocks, moved between the threads as a whole
+    struct block_batch {
+      free_block* head;
+      size_t count;
+    };
+
+    /*
+     * The free blocks of a size, shared by all the threads. A thread which frees more blocks
+     * than it allocates, a worker freeing the requests built by an IO thread for example, hands
+     * them over here in batches, and the allocating thread takes them back in batches, so the
+     * lock is taken once every batch.
+     * */
+    template<size_t Size>
+    class block_depot {
+    public:
+
+      // never destroyed, the caches of the threads may outlive the static objects
+      static block_depot& instance() {
+        static block_depot* depot = new block_depot();
+        return *depot;
+      }
+
+      void put(const block_batch& batch) {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _batches.push_back(batch);
+      }
+
+      bool take(block_batch& batch) {
+        std::lock_guard<std::mutex> guard(_mutex);
+        if (_batches.empty()) return false;
+
+        batch = _batches.back();
+        _batches.pop_back();
+        return true;
+      }
+
+    private:
+
+      std::mutex _mutex;
+      std::vector<block_batch> _batches;
+    };
+
+    /*
+     * The free blocks of a size kept by a thread : the blocks freed by the thread are allocated
+     * again by the thread first, with no lock at all. The blocks beyond batch_size are collected
+     * in a spill list, which goes to the depot once it's full.
+     * */
+    template<size_t Size>
+    class block_cache {
+    public:
+
+      static const size_t batch_size = 64;
+
+    public:
+
+      block_cache() : _head { nullptr, 0 }, _spill { nullptr, 0 } {}
+
+      ~block_cache() {
+        if (_head.head) block_depot<Size>::instance().put(_head);
+        if (_spill.head) block_depot<Size>::instance().put(_spill);
+
+        destroyed() = true;
+      }
+
+      block_cache(const block_cache&) = delete;
+      block_cache& operator=(const block_cache&) = delete;
+
+    public:
+
+      // the cache of this thread, nullptr once the thread is exiting
+      static block_cache* local() {
+        if (destroyed()) return nullptr;
+
+        static thread_local block_cache cache;
+        return &cache;
+      }
+
+      void* allocate() {
+        if (!_head.head) refill();
+        if (!_head.head) return ::operator new(Size);
+
+        free_block* b = _head.head;
+        _head.head = b->next;
+        --_head.count;
+
+        return b;
+      }
+
+      void deallocate(void* p) {
+        free_block* b = static_cast<free_block*>(p);
+
+        if (_head.count < batch_size) {
+          push(_head, b);
+          return;
+        }
+
+        push(_spill, b);
+        if (_spill.count == batch_size) {
+          block_depot<Size>::instance().put(_spill);
+          _spill = block_batch { nullptr, 0 };
+        }
+      }
+
+    private:
+
+      static bool& destroyed() {
+        static thread_local bool value = false;
+        return value;
+      }
+
+      static void push(block_batch& batch, free_block* b) {
+        b->next = batch.head;
+        batch.head = b;
+        ++batch.count;
+      }
+
+      void refill() {
+        if (_spill.head) {
+          std::swap(_head, _spill);
+          return;
+        }
+
+        block_depot<Size>::instance().take(_head);
+      }
+
+    private:
+
+      block_batch _head;
+      block_batch _spill;
+    };
+
+    // the size classes are multiples of 16 bytes, which keeps the alignment of operator new
+    template<size_t Size>
+    struct block_size {
+      static const size_t value = (Size + 15) / 16 * 16;
+    };
+
+    template<size_t Size>
+    void* pool_allocate() {
+      block_cache<Size>* cache = block_cache<Size>::local();
+      return cache ? cache->allocate() : ::operator new(Size);
+    }
+
+    template<size_t Size>
+    void pool_deallocate(void* p) {
+      block_cache<Size>* cache = block_cache<Size>::local();
+      if (cache) cache->deallocate(p);
+      else ::operator delete(p);
+    }
+
+  } // detail
+
+  /*
+   * An allocator of single objects out of thread local free lists, for the small objects created
+   * and destroyed at a high rate, so they cost no call to the global allocator in the steady state.
+   * The free blocks are never given back to the system, a pool keeps the peak number of it's
+   * objects.
+   *
+   * Arrays are allocated by the global allocator.
+   * */
+  template<typename T>
+  class pool_allocator {
+  public:
+
+    typedef T value_type;
+    typedef T* pointer;
+    typedef const T* const_pointer;
+    typedef T& reference;
+    typedef const T& const_reference;
+    typedef size_t size_type;
+    typedef ptrdiff_t difference_type;
+
+    template<typename U>
+    struct rebind {
+      typedef pool_allocator<U> other;
+    };
+
+  private:
+
+    static const size_t block = detail::block_size<sizeof(T)>::value;
+
+  public:
+
+    pool_allocator() noexcept {}
+
+    template<typename U>
+    pool_allocator(const pool_allocator<U>&) noexcept {}
+
+  public:
+
+    T* allocate(size_t n) {
+      if (n != 1) return static_cast<T*>(::operator new(n * sizeof(T)));
+
+      return static_cast<T*>(detail::pool_allocate<block>());
+    }
+
+    void deallocate(T* p, size_t n) {
+      if (n != 1) ::operator delete(p);
+      else detail::pool_deallocate<block>(p);
+    }
+
+    size_t max_size() const noexcept { return size_t(-1) / sizeof(T); }
+  };
+
+  template<typename T, typename U>
+  bool operator==(const pool_allocator<T>&, const pool_allocator<U>&) noexcept { return true; }
+
+  template<typename T, typename U>
+  bool operator!=(const pool_allocator<T>&, const pool_allocator<U>&) noexcept { return false; }
+
+  // like std::make_shared, the object and it's reference counts are a single pooled block
+  template<typename T, typename... Args>
+  std::shared_ptr<T> make_pooled(Args&&... args) {
+    return std::allocate_shared<T>(pool_allocator<T>(), std::forward<Args>(args)...);
+  }
+
+} // atlas
+
+#endif /* ATLAS_OBJECT_POOL_H_ */
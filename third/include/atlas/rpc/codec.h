@@ -0,0 +1,385 @@
+/*
+ * codec.h
+ *
+ *  Created on: Oct 17, 2013
+ *      Author: Vincent Zhang, ivincent.zhang@gmail.com
+ */
+
+/*    Copyright 2011 ~ 2013 Vincent Zhang, ivincent.zhang@gmail.com
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef ATLAS_RPC_CODEC_H_
+#define ATLAS_RPC_CODEC_H_
+
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+#include <tuple>
+#include <utility>
+#include <sstream>
+#include <stdexcept>
+#include <type_traits>
+
+#include <boost/uuid/uuid.hpp>
+
+#ifdef ATLAS_DEBUG_RPC
+
+#include <boost/archive/text_iarchive.hpp>
+#include <boost/archive/text_oarchive.hpp>
+
+#else
+
+#include <boost/archive/binary_iarchive.hpp>
+#include <boost/archive/binary_oarchive.hpp>
+
+#endif
+
+#include <atlas/io/memstream.h>
+#include <atlas/rpc/result.h>
+
+namespace atlas {
+  namespace rpc {
+
+#ifdef ATLAS_DEBUG_RPC
+
+    typedef boost::archive::text_iarchive rpc_iarchive;
+    typedef boost::archive::text_oarchive rpc_oarchive;
+
+#else
+
+    typedef boost::archive::binary_iarchive rpc_iarchive;
+    typedef boost::archive::binary_oarchive rpc_oarchive;
+
+#endif
+
+    class codec_error : public std::runtime_error {
+    public:
+
+      codec_error(const std::string& what) : std::runtime_error(what) {}
+    };
+
+    // append encoded fields to a buffer, the buffer is expected to be reserved by the caller
+    class codec_writer {
+    public:
+
+      codec_writer(std::string& buffer) : _buffer(buffer) {}
+
+    public:
+
+      void write(const void* data, size_t size) {
+        _buffer.append(static_cast<const char*>(data), size);
+      }
+
+      void write_varint(uint64_t v) {
+        char bytes[10];
+        size_t n = 0;
+
+        while (v >= 0x80) {
+          bytes[n++] = static_cast<char>(v | 0x80);
+          v >>= 7;
+        }
+        bytes[n++] = static_cast<char>(v);
+
+        _buffer.append(bytes, n);
+      }
+
+      std::string& buffer() { return _buffer; }
+
+    private:
+
+      std::string& _buffer;
+    };
+
+    // read encoded fields from a memory range, nothing is copied unless required by the target type
+    class codec_reader {
+    public:
+
+      codec_reader(const char* data, size_t size) : _p(data), _end(data + size) {}
+
+    public:
+
+      // throw codec_error
+      void read(void* data, size_t size) {
+        std::memcpy(data, take(size), size);
+      }
+
+      // throw codec_error
+      uint64_t read_varint() {
+        uint64_t v = 0;
+
+        for (int shift = 0; shift < 64; shift += 7) {
+          if (_p == _end) throw codec_error("truncated varint");
+
+          uint8_t byte = static_cast<uint8_t>(*_p++);
+          v |= static_cast<uint64_t>(byte & 0x7f) << shift;
+
+          if (!(byte & 0x80)) return v;
+        }
+
+        throw codec_error("malformed varint");
+      }
+
+      // return a pointer to the next size bytes, and skip them
+      // throw codec_error
+      const char* take(size_t size) {
+        if (static_cast<size_t>(_end - _p) < size) throw codec_error("truncated message");
+
+        const char* p = _p;
+        _p += size;
+        return p;
+      }
+
+      size_t remaining() const { return _end - _p; }
+
+    private:
+
+      const char* _p;
+      const char* _end;
+    };
+
+    /*
+     * codec<T> encodes a value with a fixed layout known at compile time, without any stream or archive.
+     *
+     * The primary template is the hook for user types : it falls back to boost.serialization, the value
+     * is serialized by a rpc_oarchive and stored as a length prefixed blob. Specialize codec<T> to give
+     * a user type a hand written layout.
+     * */
+    template<typename T, typename Enable = void>
+    struct codec {
+      static void encode(codec_writer& w, const T& v) {
+        std::ostringstream oss;
+        {
+          rpc_oarchive oa(oss, boost::archive::no_header);
+          oa << v;
+        }
+
+        std::string blob = oss.str();
+        w.write_varint(blob.size());
+        w.write(blob.data(), blob.size());
+      }
+
+      static void decode(codec_reader& r, T& v) {
+        size_t size = r.read_varint();
+        const char* data = r.take(size);
+
+        atlas::imemstream iss(data, size);
+        rpc_iarchive ia(static_cast<std::istream&>(iss), boost::archive::no_header);
+        ia >> v;
+      }
+    };
+
+    // small integers, characters, bool and floating points are written as they are
+    template<typename T>
+    struct codec<T, typename std::enable_if<std::is_floating_point<T>::value
+        || (std::is_integral<T>::value && sizeof(T) <= 2)>::type> {
+      static void encode(codec_writer& w, const T& v) { w.write(&v, sizeof(v)); }
+
+      static void decode(codec_reader& r, T& v) { r.read(&v, sizeof(v)); }
+    };
+
+    // wider unsigned integers are written as varint
+    template<typename T>
+    struct codec<T, typename std::enable_if<std::is_integral<T>::value && std::is_unsigned<T>::value
+        && (sizeof(T) > 2)>::type> {
+      static void encode(codec_writer& w, const T& v) { w.write_varint(v); }
+
+      static void decode(codec_reader& r, T& v) { v = static_cast<T>(r.read_varint()); }
+    };
+
+    // wider signed integers are zigzag encoded so that small negative numbers stay short
+    template<typename T>
+    struct codec<T, typename std::enable_if<std::is_integral<T>::value && std::is_signed<T>::value
+        && (sizeof(T) > 2)>::type> {
+      static void encode(codec_writer& w, const T& v) {
+        int64_t n = v;
+        w.write_varint((static_cast<uint64_t>(n) << 1) ^ static_cast<uint64_t>(n >> 63));
+      }
+
+      static void decode(codec_reader& r, T& v) {
+        uint64_t n = r.read_varint();
+        v = static_cast<T>(static_cast<int64_t>((n >> 1) ^ (~(n & 1) + 1)));
+      }
+    };
+
+    template<typename T>
+    struct codec<T, typename std::enable_if<std::is_enum<T>::value>::type> {
+      static void encode(codec_writer& w, const T& v) { codec<int64_t>::encode(w, static_cast<int64_t>(v)); }
+
+      static void decode(codec_reader& r, T& v) {
+        int64_t n = 0;
+        codec<int64_t>::decode(r, n);
+        v = static_cast<T>(n);
+      }
+    };
+
+    template<>
+    struct codec<std::string> {
+      static void encode(codec_writer& w, const std::string& v) {
+        w.write_varint(v.size());
+        w.write(v.data(), v.size());
+      }
+
+      static void decode(codec_reader& r, std::string& v) {
+        size_t size = r.read_varint();
+        v.assign(r.take(size), size);
+      }
+    };
+
+    template<>
+    struct codec<boost::uuids::uuid> {
+      static void encode(codec_writer& w, const boost::uuids::uuid& v) { w.write(v.data, sizeof(v.data)); }
+
+      static void decode(codec_reader& r, boost::uuids::uuid& v) { r.read(v.data, sizeof(v.data)); }
+    };
+
+    template<>
+    struct codec<rpc_result> {
+      static void encode(codec_writer& w, const rpc_result& v) {
+        if (!v) {
+          codec<std::string>::encode(w, std::string());
+          codec<int>::encode(w, 0);
+          return;
+        }
+
+        codec<std::string>::encode(w, v.data());
+        codec<int>::encode(w, v.err());
+      }
+
+      static void decode(codec_reader& r, rpc_result& v) {
+        std::string data;
+        int err = 0;
+
+        codec<std::string>::decode(r, data);
+        codec<int>::decode(r, err);
+
+        v.reset(std::move(data), err);
+      }
+    };
+
+    template<typename T, typename Alloc>
+    struct codec<std::vector<T, Alloc>> {
+      static void encode(codec_writer& w, const std::vector<T, Alloc>& v) {
+        w.write_varint(v.size());
+        for (const auto& e : v) codec<T>::encode(w, e);
+      }
+
+      static void decode(codec_reader& r, std::vector<T, Alloc>& v) {
+        size_t size = r.read_varint();
+
+        // every element takes at least one byte, do not trust a size the message can not hold
+        if (size > r.remaining()) throw codec_error("bad vector size");
+
+        v.resize(size);
+        for (auto& e : v) codec<T>::decode(r, e);
+      }
+    };
+
+    template<typename T1, typename T2>
+    struct codec<std::pair<T1, T2>> {
+      static void encode(codec_writer& w, const std::pair<T1, T2>& v) {
+        codec<T1>::encode(w, v.first);
+        codec<T2>::encode(w, v.second);
+      }
+
+      static void decode(codec_reader& r, std::pair<T1, T2>& v) {
+        codec<T1>::decode(r, v.first);
+        codec<T2>::decode(r, v.second);
+      }
+    };
+
+    namespace detail {
+
+      template<size_t idx, size_t size>
+      struct tuple_codec {
+        template<typename Tuple>
+        static void encode(codec_writer& w, const Tuple& t) {
+          codec<typename std::tuple_element<idx, Tuple>::type>::encode(w, std::get<idx>(t));
+          tuple_codec<idx + 1, size>::encode(w, t);
+        }
+
+        template<typename Tuple>
+        static void decode(codec_reader& r, Tuple& t) {
+          codec<typename std::tuple_element<idx, Tuple>::type>::decode(r, std::get<idx>(t));
+          tuple_codec<idx + 1, size>::decode(r, t);
+        }
+      };
+
+      template<size_t size>
+      struct tuple_codec<size, size> {
+        template<typename Tuple>
+        static void encode(codec_writer& w, const Tuple& t) {}
+
+        template<typename Tuple>
+        static void decode(codec_reader& r, Tuple& t) {}
+      };
+
+    } // detail
+
+    template<typename... Elements>
+    struct codec<std::tuple<Elements...>> {
+      static void encode(codec_writer& w, const std::tuple<Elements...>& t) {
+        detail::tuple_codec<0, sizeof...(Elements)>::encode(w, t);
+      }
+
+      static void decode(codec_reader& r, std::tuple<Elements...>& t) {
+        detail::tuple_codec<0, sizeof...(Elements)>::decode(r, t);
+      }
+    };
+
+    /*
+     * Encode the arguments of a remote function call. The arguments are converted to the parameter
+     * types of the remote function before they are encoded, so the caller may pass a const char*
+     * for a std::string parameter, or an int for a long parameter, and the callee still decodes
+     * exactly what it expects.
+     * */
+    template<typename Signature>
+    struct argument_codec;
+
+    template<typename Res, typename... Params>
+    struct argument_codec<Res(Params...)> {
+      typedef std::tuple<typename std::decay<Params>::type...> tuple_type;
+
+      template<typename... Args>
+      static void encode(codec_writer& w, const Args&... args) {
+        static_assert(sizeof...(Args) == sizeof...(Params), "wrong number of arguments for the remote function");
+
+        // braced initializers are evaluated in order
+        int expand[] = { 0, (codec<typename std::decay<Params>::type>::encode(w,
+            static_cast<const typename std::decay<Params>::type&>(args)), 0)... };
+        (void)expand;
+      }
+
+      static void decode(codec_reader& r, tuple_type& t) {
+        codec<tuple_type>::decode(r, t);
+      }
+    };
+
+    template<typename Res, typename... Params>
+    struct argument_codec<Res(*)(Params...)> : public argument_codec<Res(Params...)> {};
+
+#ifdef __cpp_noexcept_function_type
+    // since C++17 noexcept is a part of the function type
+    template<typename Res, typename... Params>
+    struct argument_codec<Res(Params...) noexcept> : public argument_codec<Res(Params...)> {};
+
+    template<typename Res, typename... Params>
+    struct argument_codec<Res(*)(Params...) noexcept> : public argument_codec<Res(Params...)> {};
+#endif
+
+  } // rpc
+} // atlas
+
+#endif /* ATLAS_RPC_CODEC_H_ */
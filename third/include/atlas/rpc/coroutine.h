@@ -0,0 +1,173 @@
+/*
+ * coroutine.h
+ *
+ *  Created on: Oct 17, 2013
+ *      Author: Vincent Zhang, ivincent.zhang@gmail.com
+ */
+
+/*    Copyright 2011 ~ 2013 Vincent Zhang, ivincent.zhang@gmail.com
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef ATLAS_RPC_COROUTINE_H_
+#define ATLAS_RPC_COROUTINE_H_
+
+#if __cplusplus < 202002L || !defined(__cpp_impl_coroutine)
+#error "atlas/rpc/coroutine.h requires C++20 coroutines, build with the coroutine variant"
+#endif
+
+#include <atomic>
+#include <tuple>
+#include <string>
+#include <utility>
+#include <exception>
+#include <coroutine>
+
+#include <atlas/rpc/rpc.h>
+
+namespace atlas {
+  namespace rpc {
+
+    /*
+     * Where a coroutine goes on once the result of it's call arrives. The default one resumes it
+     * right in the thread which delivers the result : resume_task runs inline, so that's the IO
+     * thread which receives the response, or the timeout thread if the call times out. A coroutine
+     * which blocks there stalls the event loop or the timer wheel, it must take a resumer which
+     * hands it to a worker instead.
+     *
+     * A plain function and a context rather than a std::function, so resuming allocates nothing.
+     * */
+    struct resumer {
+      typedef void (*resume_fn)(void* context, std::coroutine_handle<> handle);
+
+      resumer(resume_fn fn = nullptr, void* context = nullptr) : fn(fn), context(context) {}
+
+      void resume(std::coroutine_handle<> handle) const {
+        if (fn) fn(context, handle);
+        else handle.resume();
+      }
+
+      resume_fn fn;
+      void* context;
+    };
+
+    /*
+     * The awaiter of co_call : it makes an async call whose callback captures nothing but the
+     * awaiter, which fits in the small buffer of the callback, and lives in the coroutine frame.
+     *
+     * The result may arrive before await_suspend returns, so the call and the callback race for
+     * a flag : the first one does nothing, the second one goes on with the coroutine, either by
+     * not suspending it at all, or by resuming it.
+     * */
+    template<typename Functor, typename ... Args>
+    class call_awaiter {
+    public:
+
+      call_awaiter(remote_caller& caller, resumer r, Functor f, int fn_id, Args ... args)
+        : _caller(caller), _resumer(r), _f(f), _fn_id(fn_id), _args(std::move(args)...), _arrived(false) {}
+
+      call_awaiter(const call_awaiter&) = delete;
+      call_awaiter& operator=(const call_awaiter&) = delete;
+
+    public:
+
+      bool await_ready() const noexcept { return false; }
+
+      // throw what the call throws, and then the coroutine goes on with the exception
+      bool await_suspend(std::coroutine_handle<> handle) {
+        _handle = handle;
+
+        std::apply([this](Args& ... args) {
+          _caller.call(_f, _fn_id, rpc_callback_type([this](const std::string& data, int err, async_task&) {
+            on_result(data, err);
+          }), args...);
+        }, _args);
+
+        // suspend unless the result is already here
+        return !_arrived.exchange(true, std::memory_order_acq_rel);
+      }
+
+      rpc_result await_resume() { return std::move(_result); }
+
+    private:
+
+      void on_result(const std::string& data, int err) {
+        _result = rpc_result(data, err);
+
+        if (_arrived.exchange(true, std::memory_order_acq_rel)) _resumer.resume(_handle);
+      }
+
+    private:
+
+      remote_caller& _caller;
+      resumer _resumer;
+      Functor _f;
+      int _fn_id;
+      std::tuple<Args...> _args;
+
+      std::coroutine_handle<> _handle;
+      std::atomic<bool> _arrived;
+      rpc_result _result;
+    };
+
+    /*
+     * co_await co_call(caller, f, fn_id, args...) suspends the coroutine until the result of the
+     * remote call arrives, or the call times out, and evaluates to the rpc_result.
+     *
+     * The caller must live until the call is made, a temporary in the co_await expression does.
+     * */
+    template<typename Functor, typename ... Args>
+    call_awaiter<Functor, Args...> co_call(remote_caller& caller, resumer r, Functor f, int fn_id, Args ... args) {
+      return call_awaiter<Functor, Args...>(caller, r, f, fn_id, std::move(args)...);
+    }
+
+    template<typename Functor, typename ... Args>
+    call_awaiter<Functor, Args...> co_call(remote_caller& caller, Functor f, int fn_id, Args ... args) {
+      return call_awaiter<Functor, Args...>(caller, resumer(), f, fn_id, std::move(args)...);
+    }
+
+    template<typename Functor, typename ... Args>
+    call_awaiter<Functor, Args...> co_call(remote_caller&& caller, resumer r, Functor f, int fn_id, Args ... args) {
+      return call_awaiter<Functor, Args...>(caller, r, f, fn_id, std::move(args)...);
+    }
+
+    template<typename Functor, typename ... Args>
+    call_awaiter<Functor, Args...> co_call(remote_caller&& caller, Functor f, int fn_id, Args ... args) {
+      return call_awaiter<Functor, Args...>(caller, resumer(), f, fn_id, std::move(args)...);
+    }
+
+    /*
+     * The return type of a fire and forget coroutine : it runs until it's first suspension when
+     * called, and frees itself when it's done. A remote function starts one to run a multi step
+     * job and returns at once, the worker thread is never blocked.
+     * */
+    struct detached {
+      struct promise_type {
+        detached get_return_object() noexcept { return detached(); }
+
+        std::suspend_never initial_suspend() noexcept { return {}; }
+
+        std::suspend_never final_suspend() noexcept { return {}; }
+
+        void return_void() noexcept {}
+
+        // nobody is there to catch it
+        void unhandled_exception() noexcept { std::terminate(); }
+      };
+    };
+
+  } // rpc
+} // atlas
+
+#endif /* ATLAS_RPC_COROUTINE_H_ */
@@ -0,0 +1,94 @@
+/*
+ * deadline.h
+ *
+ *  Created on: Oct 17, 2013
+ *      Author: Vincent Zhang, ivincent.zhang@gmail.com
+ */
+
+/*    Copyright 2011 ~ 2013 Vincent Zhang, ivincent.zhang@gmail.com
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef ATLAS_RPC_DEADLINE_H_
+#define ATLAS_RPC_DEADLINE_H_
+
+#include <cstdint>
+#include <chrono>
+#include <algorithm>
+
+namespace atlas {
+  namespace rpc {
+
+    /*
+     * Deadlines are local steady clock time points. The clocks of two hosts are not synchronized,
+     * so a deadline travels as the time left to it when the message is sent, and the receiver
+     * turns it back into a local time point when the message arrives. The time spent on the wire
+     * is not counted, which errs on the side of doing the work.
+     * */
+    typedef std::chrono::steady_clock deadline_clock;
+    typedef deadline_clock::time_point deadline_type;
+
+    const deadline_type no_deadline = deadline_type::max();
+
+    // the time left in microseconds, 0 means no deadline, and -1 means it has passed
+    inline int64_t to_budget(const deadline_type& d) {
+      if (d == no_deadline) return 0;
+
+      int64_t left = std::chrono::duration_cast<std::chrono::microseconds>(d - deadline_clock::now()).count();
+      return left > 0 ? left : -1;
+    }
+
+    inline deadline_type from_budget(int64_t budget) {
+      if (budget == 0) return no_deadline;
+
+      return deadline_clock::now() + std::chrono::microseconds(budget);
+    }
+
+    inline bool expired(const deadline_type& d) {
+      return d != no_deadline && d <= deadline_clock::now();
+    }
+
+    namespace detail {
+
+      // a single instance for the whole program, whatever translation unit calls it
+      inline deadline_type& thread_deadline() {
+        static thread_local deadline_type d = no_deadline;
+        return d;
+      }
+
+    } // detail
+
+    // the deadline of the request executing in this thread, the calls made by it inherit the deadline
+    inline deadline_type current_deadline() { return detail::thread_deadline(); }
+
+    // set the current deadline of this thread during the scope
+    class deadline_scope {
+    public:
+
+      deadline_scope(const deadline_type& d) : _saved(detail::thread_deadline()) { detail::thread_deadline() = d; }
+
+      ~deadline_scope() { detail::thread_deadline() = _saved; }
+
+      deadline_scope(const deadline_scope&) = delete;
+      deadline_scope& operator=(const deadline_scope&) = delete;
+
+    private:
+
+      deadline_type _saved;
+    };
+
+  } // rpc
+} // atlas
+
+#endif /* ATLAS_RPC_DEADLINE_H_ */
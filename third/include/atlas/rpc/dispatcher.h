@@ -23,127 +23,92 @@
 #ifndef RFC_DISPATCHER_H_
 #define RFC_DISPATCHER_H_
 
-#include <deque>
-
-#include <boost/optional.hpp>
 #include <atlas/serialization/uuid.h>
 #include <atlas/rpc/rpc.h>
 
 namespace atlas {
   namespace rpc {
 
-    // dispatchers
-    typedef std::function<boost::optional<rpc_result>(int, const std::string&, const rpc_context&)> dispatcher_type;
-
-    class builtin_dispatcher {
+    class dispatcher_manager : public atlas::singleton<dispatcher_manager> {
     public:
 
-      static boost::optional<rpc_result> dispatch(int fn_id, const std::string& message, const rpc_context& context) {
-        std::istringstream iss(message);
-        rpc_iarchive ia(iss);
-
-        // std::cout << "dispatch " << fn_id << " for " << context.session_id() << " from " << context.source_ip();
-
-        switch (fn_id) {
-        case fn_ids::resume_thread: {
-          rf_wrapper<decltype(builtin_rfc::resume_thread)> resume_thread(builtin_rfc::resume_thread, ia, context);
-          return resume_thread();
-        }
-        break;
-        case fn_ids::resume_task: {
-          rf_wrapper<decltype(builtin_rfc::resume_task)> resume_task(builtin_rfc::resume_task, ia, context);
-          return resume_task();
-        }
-        break;
-        default:
-          // not be responsible to this rpc
-          return boost::none;
-          // DLOG(INFO) << "no method " << method;
-        break;
-        } // switch
-
-        return boost::none;
-      }
-    };
+      // the largest body we accept once decompressed
+      static const size_t max_body_size = 256 * 1024 * 1024;
 
-    class dispatcher_manager : public atlas::singleton<dispatcher_manager> {
     public:
 
-      // TODO : make it private
-      dispatcher_manager() { __init(); }
+      // throw
+      void execute(remote_caller& response_caller, const message& msg, const std::string& source_ip_port) {
+        rpc_context context(msg.header()->client_id, msg.header()->return_type, msg.header()->session_id,
+            source_ip_port, msg.header()->flags);
+        context.set_responder(&response_caller);
 
-    public:
+        rpc_result result = nullptr;
+
+        {
+          // the calls made by the remote function inherit the deadline, the response does not
+          deadline_scope scope(msg.deadline());
 
-      // we invoke the dispatcher earlier if he comes later
-      // TODO : employ priority queue
-      void regist(dispatcher_type dispatcher) {
-        using std::placeholders::_1;
-        using std::placeholders::_2;
-        using std::placeholders::_3;
+          result = dispatch(msg, context);
+        }
 
-        _dispatchers.push_front(std::bind(dispatcher, _1, _2, _3));
+        if (result) respond(response_caller, context, result);
       }
 
-      // throw
-      void execute(remote_caller& response_caller, const message& msg, const std::string& source_ip_port) {
-        rpc_context context(msg.header()->client_id, msg.header()->return_type, msg.header()->session_id, source_ip_port);
+      /*
+       * Answer the caller with an error, without running the remote function
+       *
+       * Return false if the caller expects no response, so it is not told
+       * */
+      bool reject(remote_caller& response_caller, const message& msg, const std::string& source_ip_port, errc ec) {
+        if (msg.header()->return_type == rpc_async_no_callback) return false;
 
-        auto result = atlas::rpc::dispatcher_manager::dispatch(msg.header()->fn_id, msg.rpc_str(), context);
-        if (result) respond(response_caller, context, result);
+        rpc_context context(msg.header()->client_id, msg.header()->return_type, msg.header()->session_id,
+            source_ip_port, msg.header()->flags);
+
+        respond(response_caller, context, rpc_result("", error_value(ec)));
+
+        return true;
       }
 
       void respond(remote_caller& caller, const rpc_context& context, const rpc_result& result) {
+        // do not send a compressed response to a caller who can not read it
+        caller.set_compression(context.accept_compressed());
+
         if (context.get_return_type() == rpc_async_callback) {
           caller.call(builtin_rfc::resume_task, fn_ids::resume_task, context.session_id(), result, nilctx);
         }
         else if (context.get_return_type() == rpc_sync) {
           caller.call(builtin_rfc::resume_thread, fn_ids::resume_thread, context.session_id(), result, nilctx);
         }
+        else if (context.get_return_type() == rpc_stream) {
+          // a stream which ends before any chunk is written, usually an error
+          caller.call(builtin_rfc::stream_chunk, fn_ids::stream_chunk, context.session_id(), static_cast<int64_t>(0),
+              result.data(), result.err(), true, nilctx);
+        }
       }
 
-      rpc_result dispatch(int fn_id, const std::string& message, const rpc_context& context) {
-        std::istringstream iss(message);
-        rpc_iarchive ia(iss);
+      // throw codec_error, lz::lz_error
+      rpc_result dispatch(const message& msg, const rpc_context& context) {
+        if (!msg.compressed()) return dispatch(msg.header()->fn_id, msg.body(), msg.body_size(), context);
 
-        for (const dispatcher_type& dispatcher : _dispatchers) {
-          auto result = dispatcher(fn_id, message, context);
-
-          if (result) return *result; // got a proper processor
-        }
+        std::string body;
+        lz::decompress(msg.body(), msg.body_size(), body, max_body_size);
 
-        return nullptr; // no any proper processor
+        return dispatch(msg.header()->fn_id, body.data(), body.size(), context);
       }
 
-    protected:
+      // throw codec_error
+      rpc_result dispatch(int fn_id, const char* data, size_t size, const rpc_context& context) {
+        remote_function_type fn = function_table::find(fn_id);
+        if (!fn) return nullptr; // no any proper processor
 
-      void __init() {
-        using std::placeholders::_1;
-        using std::placeholders::_2;
-        using std::placeholders::_3;
-
-        _dispatchers.push_front(std::bind(builtin_dispatcher::dispatch, _1, _2, _3));
+        codec_reader reader(data, size);
+        return fn(reader, context);
       }
-
-      std::deque<dispatcher_type> _dispatchers;
     };
 
   } // rpc
 } // atlas
 
-// TODO : use meta programming
-#define ATLAS_REGISTER_RPC_DISPATCHER(module_name, dispatcher) \
-namespace atlas { \
-  namespace rpc { \
-    namespace rpc_dispatcher_registers_for_module_##module_name { \
-        class dispatcher_register { \
-        public: \
-          dispatcher_register() { \
-            dispatcher_manager::ref().regist(dispatcher); \
-          } \
-        }; \
-        dispatcher_register register_rpc_for_module_##module_name; \
-    } \
-  } \
-}
-
 #endif // RFC_DISPATCHER_H_
@@ -0,0 +1,92 @@
+/*
+ * error.h
+ *
+ *  Created on: Oct 17, 2013
+ *      Author: Vincent Zhang, ivincent.zhang@gmail.com
+ */
+
+/*    Copyright 2011 ~ 2013 Vincent Zhang, ivincent.zhang@gmail.com
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef ATLAS_RPC_ERROR_H_
+#define ATLAS_RPC_ERROR_H_
+
+#include <string>
+#include <system_error>
+
+namespace atlas {
+  namespace rpc {
+
+    /*
+     * The error codes raised by the rpc layer itself, carried by rpc_result::err().
+     * They take the negative values, like the builtin functions take the negative ids,
+     * the positive values belong to the applications.
+     * */
+    enum class errc {
+      success = 0,
+      deadline_exceeded = -1001,
+      timeout = -1002,
+      server_busy = -1003
+    };
+
+    class rpc_error_category_impl : public std::error_category {
+    public:
+
+      virtual const char* name() const noexcept { return "rpc"; }
+
+      virtual std::string message(int code) const {
+        errc ec = static_cast<errc>(code);
+
+        switch (ec) {
+        case errc::success:
+          return "The rpc layer is ok";
+        case errc::deadline_exceeded:
+          return "The deadline of the request is exceeded";
+        case errc::timeout:
+          return "No response in time";
+        case errc::server_busy:
+          return "The server is too busy to take the request";
+        default:
+          return "Unknown rpc error.";
+        }
+      }
+    };
+
+    inline const std::error_category& rpc_error_category() noexcept {
+      static rpc_error_category_impl instance;
+      return instance;
+    }
+
+    inline std::error_code make_error_code(errc e) {
+      return std::error_code(static_cast<int>(e), rpc_error_category());
+    }
+
+    inline std::error_condition make_error_condition(errc e) {
+      return std::error_condition(static_cast<int>(e), rpc_error_category());
+    }
+
+    // the value carried by rpc_result::err()
+    inline int error_value(errc e) { return static_cast<int>(e); }
+
+  } // rpc
+} // atlas
+
+namespace std {
+  template<>
+  struct is_error_code_enum<atlas::rpc::errc> : public true_type {
+  };
+}
+
+#endif /* ATLAS_RPC_ERROR_H_ */
@@ -0,0 +1,413 @@
+/*
+ * future.h
+ *
+ *  Created on: Oct 17, 2013
+ *      Author: Vincent Zhang, ivincent.zhang@gmail.com
+ */
+
+/*    Copyright 2011 ~ 2013 Vincent Zhang, ivincent.zhang@gmail.com
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef ATLAS_RPC_FUTURE_H_
+#define ATLAS_RPC_FUTURE_H_
+
+#include <cassert>
+#include <atomic>
+#include <mutex>
+#include <memory>
+#include <vector>
+#include <utility>
+#include <functional>
+#include <type_traits>
+#include <condition_variable>
+
+#include <atlas/rpc/result.h>
+
+namespace atlas {
+  namespace rpc {
+
+    template<typename T> class basic_future;
+    template<typename T> class basic_promise;
+
+    namespace detail {
+
+      // the value of a void future
+      struct unit {};
+
+      /*
+       * The state shared by a promise and it's futures : the value, and at most one continuation.
+       * A single allocation with an intrusive reference count, it's freed with the last reference.
+       *
+       * The continuation is not how wait() blocks, it waits for the value on the condition of the
+       * state, so a future can be waited for and continued both.
+       * */
+      template<typename T>
+      class future_state {
+      public:
+
+        enum status_type { empty, has_continuation, ready };
+
+      public:
+
+        future_state() : _refs(1), _status(empty) {}
+
+        future_state(const future_state&) = delete;
+        future_state& operator=(const future_state&) = delete;
+
+      public:
+
+        void add_ref() { _refs.fetch_add(1, std::memory_order_relaxed); }
+
+        void release() {
+          if (_refs.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this;
+        }
+
+        bool is_ready() const { return _status.load(std::memory_order_acquire) == ready; }
+
+        // only the first value counts, return false for the others
+        bool set_value(T value) {
+          std::function<void(const T&)> continuation;
+
+          {
+            std::lock_guard<std::mutex> guard(_mutex);
+            if (_status.load(std::memory_order_relaxed) == ready) return false;
+
+            _value = std::move(value);
+            continuation.swap(_continuation);
+            _status.store(ready, std::memory_order_release);
+          }
+
+          _ready_event.notify_all();
+
+          // the value does not change any more, the continuation reads it out of the lock
+          if (continuation) continuation(_value);
+
+          return true;
+        }
+
+        // the continuation runs in the thread which sets the value, or right now if the value is ready
+        void set_continuation(std::function<void(const T&)> continuation) {
+          {
+            std::lock_guard<std::mutex> guard(_mutex);
+
+            if (_status.load(std::memory_order_relaxed) != ready) {
+              // a single continuation, chain them with then()
+              assert(_status.load(std::memory_order_relaxed) == empty);
+
+              _continuation = std::move(continuation);
+              _status.store(has_continuation, std::memory_order_relaxed);
+              return;
+            }
+          }
+
+          continuation(_value);
+        }
+
+        void wait() {
+          if (is_ready()) return;
+
+          std::unique_lock<std::mutex> lock(_mutex);
+          _ready_event.wait(lock, [this]() { return _status.load(std::memory_order_relaxed) == ready; });
+        }
+
+        const T& value() const { return _value; }
+
+      private:
+
+        std::atomic<int> _refs;
+        std::atomic<int> _status;
+        T _value;
+        std::function<void(const T&)> _continuation;
+
+        std::mutex _mutex;
+        std::condition_variable _ready_event;
+      };
+
+      // set the promise with f(args...), which may return void
+      template<typename R>
+      struct fulfil {
+        template<typename Promise, typename F, typename ... Args>
+        static void apply(const Promise& p, F& f, Args& ... args) { p.set_value(f(args...)); }
+      };
+
+      template<>
+      struct fulfil<void> {
+        template<typename Promise, typename F, typename ... Args>
+        static void apply(const Promise& p, F& f, Args& ... args) {
+          f(args...);
+          p.set_value();
+        }
+      };
+
+    } // detail
+
+    /*
+     * A lightweight future : a single reference counted state, no std::promise, no shared_ptr.
+     *
+     * A future takes one continuation, set by then() or on_ready(), and can be waited for by wait()
+     * or get() as well. A continuation passed to then() returns a value R, void included, and makes
+     * a basic_future<R>, so continuations chain.
+     * */
+    template<typename T>
+    class basic_future {
+    public:
+
+      typedef T value_type;
+
+    public:
+
+      basic_future() : _state(nullptr) {}
+
+      basic_future(const basic_future& other) : _state(other._state) { if (_state) _state->add_ref(); }
+
+      basic_future(basic_future&& other) : _state(other._state) { other._state = nullptr; }
+
+      ~basic_future() { if (_state) _state->release(); }
+
+      basic_future& operator=(basic_future other) {
+        std::swap(_state, other._state);
+        return *this;
+      }
+
+    public:
+
+      bool valid() const { return _state != nullptr; }
+
+      bool is_ready() const { return _state && _state->is_ready(); }
+
+      // block until the value is ready
+      void wait() { _state->wait(); }
+
+      const T& get() {
+        wait();
+        return _state->value();
+      }
+
+      // run f(value) in the thread which sets the value, and make no new future
+      void on_ready(std::function<void(const T&)> f) { _state->set_continuation(std::move(f)); }
+
+      // run f(value) in the thread which sets the value
+      template<typename F>
+      auto then(F f) -> basic_future<typename std::result_of<F(const T&)>::type> {
+        return then_impl(f, [](const std::function<void()>& task) { task(); });
+      }
+
+      // run f(value) with the executor, which must offer schedule(task), a thread pool for example
+      template<typename Executor, typename F>
+      auto then(Executor& executor, F f) -> basic_future<typename std::result_of<F(const T&)>::type> {
+        return then_impl(f, [&executor](const std::function<void()>& task) { executor.schedule(task); });
+      }
+
+    private:
+
+      friend class basic_promise<T>;
+
+      explicit basic_future(detail::future_state<T>* state) : _state(state) { _state->add_ref(); }
+
+      template<typename F, typename Launcher>
+      auto then_impl(F f, Launcher launch) -> basic_future<typename std::result_of<F(const T&)>::type> {
+        typedef typename std::result_of<F(const T&)>::type result_type;
+
+        basic_promise<result_type> next;
+        basic_future<result_type> future = next.get_future();
+
+        _state->set_continuation([f, launch, next](const T& value) mutable {
+          basic_promise<result_type> p = next;
+          launch([f, p, value]() mutable { detail::fulfil<result_type>::apply(p, f, value); });
+        });
+
+        return future;
+      }
+
+    private:
+
+      detail::future_state<T>* _state;
+    };
+
+    // a future with no value, it tells that something is done
+    template<>
+    class basic_future<void> {
+    public:
+
+      typedef void value_type;
+
+    public:
+
+      basic_future() : _state(nullptr) {}
+
+      basic_future(const basic_future& other) : _state(other._state) { if (_state) _state->add_ref(); }
+
+      basic_future(basic_future&& other) : _state(other._state) { other._state = nullptr; }
+
+      ~basic_future() { if (_state) _state->release(); }
+
+      basic_future& operator=(basic_future other) {
+        std::swap(_state, other._state);
+        return *this;
+      }
+
+    public:
+
+      bool valid() const { return _state != nullptr; }
+
+      bool is_ready() const { return _state && _state->is_ready(); }
+
+      void wait() { _state->wait(); }
+
+      void get() { wait(); }
+
+      void on_ready(std::function<void()> f) {
+        _state->set_continuation([f](const detail::unit&) { f(); });
+      }
+
+      template<typename F>
+      auto then(F f) -> basic_future<typename std::result_of<F()>::type> {
+        return then_impl(f, [](const std::function<void()>& task) { task(); });
+      }
+
+      template<typename Executor, typename F>
+      auto then(Executor& executor, F f) -> basic_future<typename std::result_of<F()>::type> {
+        return then_impl(f, [&executor](const std::function<void()>& task) { executor.schedule(task); });
+      }
+
+    private:
+
+      friend class basic_promise<void>;
+
+      explicit basic_future(detail::future_state<detail::unit>* state) : _state(state) { _state->add_ref(); }
+
+      template<typename F, typename Launcher>
+      auto then_impl(F f, Launcher launch) -> basic_future<typename std::result_of<F()>::type> {
+        typedef typename std::result_of<F()>::type result_type;
+
+        basic_promise<result_type> next;
+        basic_future<result_type> future = next.get_future();
+
+        _state->set_continuation([f, launch, next](const detail::unit&) mutable {
+          basic_promise<result_type> p = next;
+          launch([f, p]() mutable { detail::fulfil<result_type>::apply(p, f); });
+        });
+
+        return future;
+      }
+
+    private:
+
+      detail::future_state<detail::unit>* _state;
+    };
+
+    template<typename T>
+    class basic_promise {
+    public:
+
+      basic_promise() : _state(new detail::future_state<T>()) {}
+
+      basic_promise(const basic_promise& other) : _state(other._state) { _state->add_ref(); }
+
+      ~basic_promise() { if (_state) _state->release(); }
+
+      basic_promise& operator=(basic_promise other) {
+        std::swap(_state, other._state);
+        return *this;
+      }
+
+    public:
+
+      basic_future<T> get_future() const { return basic_future<T>(_state); }
+
+      // only the first value counts, return false for the others
+      bool set_value(T value) const { return _state->set_value(std::move(value)); }
+
+    private:
+
+      detail::future_state<T>* _state;
+    };
+
+    template<>
+    class basic_promise<void> {
+    public:
+
+      basic_promise() : _state(new detail::future_state<detail::unit>()) {}
+
+      basic_promise(const basic_promise& other) : _state(other._state) { _state->add_ref(); }
+
+      ~basic_promise() { if (_state) _state->release(); }
+
+      basic_promise& operator=(basic_promise other) {
+        std::swap(_state, other._state);
+        return *this;
+      }
+
+    public:
+
+      basic_future<void> get_future() const { return basic_future<void>(_state); }
+
+      // only the first call counts, return false for the others
+      bool set_value() const { return _state->set_value(detail::unit()); }
+
+    private:
+
+      detail::future_state<detail::unit>* _state;
+    };
+
+    typedef basic_future<rpc_result> rpc_future;
+    typedef basic_promise<rpc_result> rpc_promise;
+
+    // ready when all the futures are ready, the values keep the order of the futures
+    template<typename T>
+    basic_future<std::vector<T>> when_all(std::vector<basic_future<T>>& futures) {
+      struct all_state {
+        all_state(size_t n) : values(n), remain(n) {}
+
+        basic_promise<std::vector<T>> promise;
+        std::vector<T> values;
+        std::atomic<size_t> remain;
+      };
+
+      auto state = std::make_shared<all_state>(futures.size());
+      basic_future<std::vector<T>> result = state->promise.get_future();
+
+      if (futures.empty()) state->promise.set_value(std::vector<T>());
+
+      for (size_t i = 0; i < futures.size(); ++i) {
+        futures[i].on_ready([state, i](const T& value) {
+          state->values[i] = value;
+          if (--state->remain == 0) state->promise.set_value(std::move(state->values));
+        });
+      }
+
+      return result;
+    }
+
+    // ready when any of the futures is ready, with the index and the value of the first one
+    template<typename T>
+    basic_future<std::pair<size_t, T>> when_any(std::vector<basic_future<T>>& futures) {
+      basic_promise<std::pair<size_t, T>> promise;
+      basic_future<std::pair<size_t, T>> result = promise.get_future();
+
+      for (size_t i = 0; i < futures.size(); ++i) {
+        futures[i].on_ready([promise, i](const T& value) {
+          // the late ones are ignored
+          promise.set_value(std::make_pair(i, value));
+        });
+      }
+
+      return result;
+    }
+
+  } // rpc
+} // atlas
+
+#endif /* ATLAS_RPC_FUTURE_H_ */
@@ -24,16 +24,29 @@
 #define ATLAS_RFC_MESSAGE_H_
 
 #include <cstring>
+#include <memory>
+#include <string>
+#include <vector>
 
 #include <boost/uuid/uuid.hpp>
 #include <boost/uuid/uuid_io.hpp>
 
+#include <atlas/rpc/deadline.h>
+
 namespace atlas {
   namespace rpc {
 
     using boost::uuids::uuid;
 
-    enum return_type { rpc_sync, rpc_async_callback, rpc_async_no_callback };
+    enum return_type { rpc_sync, rpc_async_callback, rpc_async_no_callback, rpc_stream };
+
+    // bump it when the layout of request_header changes
+    const int16_t header_version = 2;
+
+    enum header_flags {
+      body_compressed = 0x01,   // the body is compressed by atlas::lz
+      accept_compressed = 0x02  // the sender understands compressed responses
+    };
 
     // TODO : check the alignment, when should be 4 and when 8? what's the difference?
 #pragma pack(4)
@@ -45,6 +58,9 @@ namespace atlas {
       int32_t client_id;        // 4 client id, indicate where the request comes from
       uuid    session_id;       // 5 the current session id
       int32_t resp_expect;      // 6 expected response count
+      int16_t version;          // 7 header version, see rpc::header_version
+      int16_t flags;            // 8 see rpc::header_flags
+      int64_t budget;           // 9 microseconds left to the deadline when sent, see rpc::to_budget
     };
 
 #pragma pack()
@@ -55,6 +71,63 @@ namespace atlas {
       return os;
     }
 
+    /*
+     * A buffer to build an outgoing message in, taken from a small per-thread pool and given back
+     * when the message is sent, so the buffers and their capacity are reused by the next calls.
+     * A message built while another one is being sent, a response built in a loopback for example,
+     * takes a buffer of it's own.
+     * */
+    class message_buffer {
+    public:
+
+      // the spare buffers a thread keeps
+      static const size_t max_spares = 8;
+
+      // a larger buffer is freed, not kept
+      static const size_t max_kept_capacity = 64 * 1024;
+
+    public:
+
+      message_buffer() {
+        std::vector<std::string>& s = spares();
+        if (s.empty()) return;
+
+        _buffer.swap(s.back());
+        s.pop_back();
+      }
+
+      ~message_buffer() {
+        std::vector<std::string>& s = spares();
+        if (s.size() >= max_spares || _buffer.capacity() > max_kept_capacity) return;
+
+        _buffer.clear();
+        s.push_back(std::move(_buffer));
+      }
+
+      message_buffer(const message_buffer&) = delete;
+      message_buffer& operator=(const message_buffer&) = delete;
+
+    public:
+
+      std::string& str() { return _buffer; }
+
+    private:
+
+      static std::vector<std::string>& spares() {
+        static thread_local std::vector<std::string> s;
+        if (s.capacity() == 0) s.reserve(max_spares);
+        return s;
+      }
+
+    private:
+
+      std::string _buffer;
+    };
+
+    // the owner of a block of bytes received from the network, several messages decoded
+    // from a single read refer to the same block, which is released with the last of them
+    typedef std::shared_ptr<const void> block_owner;
+
     class message {
     public:
 
@@ -70,6 +143,9 @@ namespace atlas {
           0,                                  // client id
           session_id,                         // session id
           1,                                  // resp_expect
+          header_version,                     // version
+          accept_compressed,                  // flags
+          0                                   // budget, no deadline
         };
       }
 
@@ -77,29 +153,56 @@ namespace atlas {
 
       static const size_t request_header_size = sizeof(request_header);
 
-      message(const std::string& data) : _header(*reinterpret_cast<const request_header*>(data.data())),
-        _body(data.c_str() + request_header_size, data.size() - request_header_size) {}
+      message() : _body(nullptr), _body_size(0), _deadline(no_deadline) { std::memset(&_header, 0, sizeof _header); }
+
+      // refer to [data, data + size) inside the block, no copy
+      message(const block_owner& block, const char* data, size_t size) :
+        _block(block), _body(data + request_header_size), _body_size(size - request_header_size)
+      {
+        std::memcpy(&_header, data, sizeof _header);
+        _deadline = from_budget(_header.budget);
+      }
 
-      message(const char* data, size_t size) : _header(*reinterpret_cast<const request_header*>(data)),
-        _body(data + request_header_size, size - request_header_size) {}
+      // take a private copy of the data, for the data which will not live long enough
+      message(const char* data, size_t size) : _body(nullptr), _body_size(0) {
+        reset(data, size);
+      }
 
-      void reset(const std::string& data) {
-        reset(data.data(), data.size());
+      void reset(const block_owner& block, const char* data, size_t size) {
+        std::memcpy(&_header, data, sizeof _header);
+        _deadline = from_budget(_header.budget);
+        _block = block;
+        _body = data + request_header_size;
+        _body_size = size - request_header_size;
       }
 
       void reset(const char* data, size_t size) {
-        std::memcpy(&_header, data, sizeof _header);
-        _body.assign(data + request_header_size, size - request_header_size);
+        auto copy = std::make_shared<std::string>(data, size);
+        reset(copy, copy->data(), copy->size());
       }
 
       const request_header* header() const { return &_header; }
 
-      const std::string& rpc_str() const { return _body; }
+      const char* body() const { return _body; }
+
+      size_t body_size() const { return _body_size; }
+
+      bool empty() const { return _body_size == 0; }
+
+      bool compressed() const { return _header.flags & body_compressed; }
+
+      // the local deadline, computed when the message arrives
+      const deadline_type& deadline() const { return _deadline; }
+
+      bool expired() const { return rpc::expired(_deadline); }
 
     private:
 
       request_header _header;
-      std::string _body;
+      block_owner _block;
+      const char* _body;
+      size_t _body_size;
+      deadline_type _deadline;
     };
 
   } // rpc
@@ -0,0 +1,242 @@
+/*
+ * pending.h
+ *
+ *  Created on: Oct 17, 2013
+ *      Author: Vincent Zhang, ivincent.zhang@gmail.com
+ */
+
+/*    Copyright 2011 ~ 2013 Vincent Zhang, ivincent.zhang@gmail.com
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef ATLAS_RPC_PENDING_H_
+#define ATLAS_RPC_PENDING_H_
+
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <vector>
+#include <stdexcept>
+
+#include <boost/uuid/uuid.hpp>
+
+#include <atlas/rpc/session_id.h>
+
+namespace atlas {
+  namespace rpc {
+
+    using boost::uuids::uuid;
+
+    /*
+     * The calls waiting for their responses, indexed by session id.
+     *
+     * The session id of a pending call is the address of it's slot : the sequence part of the id
+     * has the top bit set, a generation in the next 31 bits and the slot index in the low 32 bits.
+     * So a look up is an index into the slot array, and a late response for a released slot is
+     * told apart by the generation. Every slot has it's own lock, and the free slots are kept in
+     * several striped lists, so there is no lock shared by all the calls.
+     *
+     * Value is expected to be cheap to copy, a shared pointer typically.
+     * */
+    template<typename Value>
+    class pending_table {
+    public:
+
+      static const uint64_t slot_flag = 1ULL << 63;
+
+      static const size_t chunk_size = 4096;
+      static const size_t max_chunks = 1024;
+      static const size_t stripe_count = 16;
+
+    private:
+
+      struct slot {
+        slot() : generation(0), used(false) {}
+
+        std::mutex mutex;
+        uint32_t generation;
+        bool used;
+        Value value;
+      };
+
+      struct stripe {
+        std::mutex mutex;
+        std::vector<uint32_t> free_slots;
+      };
+
+    public:
+
+      pending_table() : _chunk_count(0), _size(0) {
+        for (auto& c : _chunks) c.store(nullptr, std::memory_order_relaxed);
+      }
+
+      ~pending_table() {
+        for (auto& c : _chunks) delete[] c.load(std::memory_order_relaxed);
+      }
+
+      pending_table(const pending_table&) = delete;
+      pending_table& operator=(const pending_table&) = delete;
+
+    public:
+
+      static bool is_slot_id(const uuid& id) {
+        return (session_id_generator::sequence_of(id) & slot_flag)
+            && session_id_generator::node_of(id) == session_id_generator::node_id();
+      }
+
+      // throw std::runtime_error if there are too many pending calls
+      uuid insert(const Value& value) {
+        uint32_t index = allocate();
+        slot& s = at(index);
+
+        uint32_t generation = 0;
+        {
+          std::lock_guard<std::mutex> guard(s.mutex);
+          generation = s.generation = (s.generation + 1) & 0x7fffffff;
+          s.used = true;
+          s.value = value;
+        }
+
+        ++_size;
+
+        return session_id_generator::make(session_id_generator::node_id(),
+            slot_flag | (static_cast<uint64_t>(generation) << 32) | index);
+      }
+
+      // return a copy of the value, or a default constructed one if the id is unknown or stale
+      Value find(const uuid& id) const {
+        uint32_t index = 0, generation = 0;
+        if (!decode(id, index, generation)) return Value();
+
+        slot& s = at(index);
+
+        std::lock_guard<std::mutex> guard(s.mutex);
+        if (!s.used || s.generation != generation) return Value();
+
+        return s.value;
+      }
+
+      // release the slot, and move the value out to *value if required
+      bool erase(const uuid& id, Value* value = nullptr) {
+        uint32_t index = 0, generation = 0;
+        if (!decode(id, index, generation)) return false;
+
+        slot& s = at(index);
+        Value old = Value();
+
+        {
+          std::lock_guard<std::mutex> guard(s.mutex);
+          if (!s.used || s.generation != generation) return false;
+
+          s.used = false;
+          std::swap(old, s.value);
+        }
+
+        --_size;
+        deallocate(index);
+
+        // destroy the old value out of the lock
+        if (value) std::swap(*value, old);
+
+        return true;
+      }
+
+      size_t size() const { return _size; }
+
+    private:
+
+      bool decode(const uuid& id, uint32_t& index, uint32_t& generation) const {
+        if (!is_slot_id(id)) return false;
+
+        uint64_t sequence = session_id_generator::sequence_of(id);
+        index = static_cast<uint32_t>(sequence);
+        generation = static_cast<uint32_t>(sequence >> 32) & 0x7fffffff;
+
+        return index < _chunk_count.load(std::memory_order_acquire) * chunk_size;
+      }
+
+      slot& at(uint32_t index) const {
+        return _chunks[index / chunk_size].load(std::memory_order_acquire)[index % chunk_size];
+      }
+
+      stripe& home_stripe() {
+        static std::atomic<size_t> next_stripe(0);
+        static thread_local size_t home = next_stripe++ % stripe_count;
+
+        return _stripes[home];
+      }
+
+      uint32_t allocate() {
+        stripe& home = home_stripe();
+        size_t first = &home - _stripes;
+
+        for (size_t i = 0; i < stripe_count; ++i) {
+          stripe& st = _stripes[(first + i) % stripe_count];
+
+          std::lock_guard<std::mutex> guard(st.mutex);
+          if (!st.free_slots.empty()) {
+            uint32_t index = st.free_slots.back();
+            st.free_slots.pop_back();
+            return index;
+          }
+        }
+
+        return grow(home);
+      }
+
+      void deallocate(uint32_t index) {
+        stripe& st = home_stripe();
+
+        std::lock_guard<std::mutex> guard(st.mutex);
+        st.free_slots.push_back(index);
+      }
+
+      // add a chunk of slots, keep one for the caller and give the others to the stripe
+      uint32_t grow(stripe& st) {
+        size_t chunk = 0;
+
+        {
+          std::lock_guard<std::mutex> guard(_grow_mutex);
+
+          chunk = _chunk_count.load(std::memory_order_relaxed);
+          if (chunk == max_chunks) throw std::runtime_error("too many pending calls");
+
+          _chunks[chunk].store(new slot[chunk_size], std::memory_order_release);
+          _chunk_count.store(chunk + 1, std::memory_order_release);
+        }
+
+        uint32_t first = static_cast<uint32_t>(chunk * chunk_size);
+
+        std::lock_guard<std::mutex> guard(st.mutex);
+        for (uint32_t i = chunk_size - 1; i > 0; --i) {
+          st.free_slots.push_back(first + i);
+        }
+
+        return first;
+      }
+
+    private:
+
+      std::atomic<slot*> _chunks[max_chunks];
+      std::atomic<size_t> _chunk_count;
+      std::atomic<size_t> _size;
+
+      std::mutex _grow_mutex;
+      stripe _stripes[stripe_count];
+    };
+
+  } // rpc
+} // atlas
+
+#endif /* ATLAS_RPC_PENDING_H_ */
@@ -25,6 +25,9 @@
 
 #include <string>
 #include <memory>
+#include <utility>
+
+#include <atlas/object_pool.h>
 
 namespace atlas {
   namespace rpc {
@@ -32,7 +35,7 @@ namespace atlas {
     struct __rpc_result {
       __rpc_result(const std::string& data = "", int ec = 0) : data(data), ec(ec) {}
 
-      __rpc_result(std::string&& data, int ec) : data(data), ec(ec) { }
+      __rpc_result(std::string&& data, int ec) : data(std::move(data)), ec(ec) { }
 
       __rpc_result(const __rpc_result& other) : data(other.data), ec(other.ec) {}
 
@@ -43,40 +46,35 @@ namespace atlas {
     // the result of the function call to the remote side
     // every result brings the result data and an error code, 0 means no error
     // null result means we no response to the remote caller
+    // a result is immutable, so the copies share the same data, which comes from a pool
     class rpc_result {
     public:
 
       // null result must be the final result
       rpc_result(std::nullptr_t) {}
 
-      rpc_result(const std::string& data = "", int ec = 0) : _impl(new __rpc_result(data, ec)) { }
+      rpc_result(const std::string& data = "", int ec = 0) : _impl(atlas::make_pooled<__rpc_result>(data, ec)) { }
 
-      rpc_result(std::string&& data, int ec = 0) : _impl(new __rpc_result(data, ec)) { }
+      rpc_result(std::string&& data, int ec = 0) : _impl(atlas::make_pooled<__rpc_result>(std::move(data), ec)) { }
 
-      rpc_result(const rpc_result& other) {
-        if (other._impl) _impl.reset(new __rpc_result(*other._impl));
-      }
+      rpc_result(const rpc_result& other) : _impl(other._impl) {}
 
       rpc_result(rpc_result&& r) : _impl(std::move(r._impl)) {}
 
       rpc_result& operator=(const rpc_result& other) {
-        if (std::addressof(other) == this) return *this;
-
-        if (other._impl) _impl.reset(new __rpc_result(*other._impl));
+        _impl = other._impl;
         return *this;
       }
 
       rpc_result& operator=(rpc_result&& other) {
-        if (std::addressof(other) == this) return *this;
-
-        _impl = other._impl;
+        if (std::addressof(other) != this) _impl = std::move(other._impl);
         return *this;
       }
 
     public:
 
       void reset(const std::string& data = "", int ec = 0) {
-        _impl.reset(new __rpc_result(data, ec));
+        _impl = atlas::make_pooled<__rpc_result>(data, ec);
       }
 
       operator bool() const { return _impl.operator bool(); }
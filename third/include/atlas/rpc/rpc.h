@@ -26,30 +26,27 @@
 #include <string>
 #include <functional>
 #include <tuple>
+#include <stdexcept>
 
 #include <boost/lexical_cast.hpp>
 
 #include <boost/uuid/uuid.hpp>
-#include <boost/uuid/random_generator.hpp>
 #include <boost/uuid/nil_generator.hpp>
 
-#ifdef ATLAS_DEBUG_RPC
-
-#include <boost/archive/text_iarchive.hpp>
-#include <boost/archive/text_oarchive.hpp>
-
-#else
-
-#include <boost/archive/binary_iarchive.hpp>
-#include <boost/archive/binary_oarchive.hpp>
-
-#endif
-
+#include <atlas/object_pool.h>
+#include <atlas/compress/lz.h>
 #include <atlas/serialization/tuple.h>
 #include <atlas/apply_tuple.h>
 
 #include <atlas/rpc/message.h>
+#include <atlas/rpc/codec.h>
+#include <atlas/rpc/error.h>
+#include <atlas/rpc/deadline.h>
+#include <atlas/rpc/session_id.h>
 #include <atlas/rpc/task.h>
+#include <atlas/rpc/stream.h>
+#include <atlas/rpc/timeout.h>
+#include <atlas/rpc/future.h>
 
 namespace atlas {
   namespace rpc {
@@ -57,23 +54,6 @@ namespace atlas {
     using std::string;
     using boost::uuids::uuid;
     using boost::uuids::nil_uuid;
-    using boost::uuids::random_generator;
-
-#ifdef ATLAS_DEBUG_RPC
-
-    typedef boost::archive::text_iarchive rpc_iarchive;
-    typedef boost::archive::text_oarchive rpc_oarchive;
-
-#else
-
-    typedef boost::archive::binary_iarchive rpc_iarchive;
-    typedef boost::archive::binary_oarchive rpc_oarchive;
-
-#endif
-
-#define ATLAS_REGISTER_REMOTE_FUNC(func_name, func_id) namespace fn_ids { \
-    static const int func_name = func_id; \
-};
 
     template<typename... T>
     class rf_wrapper;
@@ -90,13 +70,12 @@ namespace atlas {
 
       rf_wrapper(rf_wrapper&& other) : _args(std::move(other._args)), _f(std::move(other._f)) {}
 
-      // TODO : add OArchive concept check
-      template<typename Functor, typename OArchiver>
-      rf_wrapper(Functor f, Args... args, OArchiver& ar,
+      template<typename Functor>
+      rf_wrapper(Functor f, Args... args, codec_writer& w,
           typename std::enable_if<!std::is_integral<Functor>::value, std::nullptr_t>::type = nullptr) :
           _args(args...), _f(f)
       {
-        ar << _args;
+        codec<decltype(_args)>::encode(w, _args);
       }
 
       rf_wrapper& operator=(const rf_wrapper& other) {
@@ -111,14 +90,14 @@ namespace atlas {
 
       /*
        * The last parameter can be replaced by a local variable
-       * TODO : add IArchive concept check
+       * throw codec_error if the message is malformed
        * */
-      template<typename Functor, typename IArchiver, typename NativeArg>
-      rf_wrapper(Functor f, IArchiver& ia, const NativeArg& native_arg,
+      template<typename Functor, typename NativeArg>
+      rf_wrapper(Functor f, codec_reader& r, const NativeArg& native_arg,
           typename std::enable_if<!std::is_integral<Functor>::value, std::nullptr_t>::type = nullptr) :
           _f(f)
       {
-        ia >> _args;
+        codec<decltype(_args)>::decode(r, _args);
         std::get<sizeof...(Args) - 1>(_args) = native_arg;
       }
 
@@ -137,58 +116,74 @@ namespace atlas {
       std::function<Res (Args...)> _f;
     };
 
+#ifdef __cpp_noexcept_function_type
+    // since C++17 noexcept is a part of the function type, and the remote functions are noexcept
+    template<typename Res, typename... Args>
+    class rf_wrapper<Res(Args...) noexcept> : public rf_wrapper<Res(Args...)> {
+    public:
+
+      using rf_wrapper<Res(Args...)>::rf_wrapper;
+    };
+#endif
+
+    class remote_caller;
+
     struct __rpc_context {
 
-      __rpc_context() : client_id(0), rt(return_type::rpc_async_no_callback) {}
+      __rpc_context() : client_id(0), rt(return_type::rpc_async_no_callback), flags(0), responder(nullptr) {}
 
-      __rpc_context(int client_id, int rt, const uuid& session_id, const std::string& source_ip_port) :
-        client_id(client_id), rt(rt), session_id(session_id), source_ip_port(source_ip_port)
+      __rpc_context(int client_id, int rt, const uuid& session_id, const std::string& source_ip_port, int flags) :
+        client_id(client_id), rt(rt), flags(flags), responder(nullptr), session_id(session_id),
+        source_ip_port(source_ip_port)
       {}
 
       __rpc_context(const __rpc_context& other)
-        : client_id(other.client_id), rt(other.rt), session_id(other.session_id), source_ip_port(other.source_ip_port)
+        : client_id(other.client_id), rt(other.rt), flags(other.flags), responder(other.responder),
+          session_id(other.session_id), source_ip_port(other.source_ip_port)
       {}
 
       int client_id;
       int rt;
+      int flags; // the header flags of the request
+      remote_caller* responder; // talks back to the caller, valid while the request is executing
       uuid session_id;
       std::string source_ip_port;
     };
 
+    /*
+     * The copies of a context share the same state, which is created once per request, out of
+     * a pool. The state is read only once shared, a setter called on a shared state copies it
+     * first, so it never changes under another copy.
+     * */
     class rpc_context {
     public:
 
       rpc_context(std::nullptr_t) {}
 
-      rpc_context() : _impl(new __rpc_context) {}
+      rpc_context() : _impl(atlas::make_pooled<__rpc_context>()) {}
 
-      rpc_context(int client_id, int return_type, const uuid& session_id, const std::string& source_ip_port) :
-          _impl(new __rpc_context(client_id, return_type, session_id, source_ip_port)) {
+      rpc_context(int client_id, int return_type, const uuid& session_id, const std::string& source_ip_port,
+          int flags = 0) :
+          _impl(atlas::make_pooled<__rpc_context>(client_id, return_type, session_id, source_ip_port, flags)) {
       }
 
-      rpc_context(const rpc_context& other) : _impl(other._impl ? new __rpc_context(*other._impl)  : nullptr) {
-      }
+      rpc_context(const rpc_context& other) : _impl(other._impl) {}
 
       rpc_context(rpc_context&& other) : _impl(std::move(other._impl)) {}
 
-      rpc_context operator=(const rpc_context& other) {
-        if (std::addressof(other) == this) return *this;
-
-        if (other._impl) _impl.reset(new __rpc_context(*other._impl));
-
+      rpc_context& operator=(const rpc_context& other) {
+        _impl = other._impl;
         return *this;
       }
 
-      rpc_context operator=(rpc_context&& other) {
-        if (std::addressof(other) == this) return *this;
-
-        if (other._impl) _impl = other._impl;
-
+      rpc_context& operator=(rpc_context&& other) {
+        if (std::addressof(other) != this) _impl = std::move(other._impl);
         return *this;
       }
 
-      void reset(int client_id, int return_type, const uuid& session_id, const std::string& source_ip_port) {
-        _impl.reset(new __rpc_context(client_id, return_type, session_id, source_ip_port));
+      void reset(int client_id, int return_type, const uuid& session_id, const std::string& source_ip_port,
+          int flags = 0) {
+        _impl = atlas::make_pooled<__rpc_context>(client_id, return_type, session_id, source_ip_port, flags);
       }
 
       int client_id() const { return _impl->client_id; }
@@ -201,6 +196,17 @@ namespace atlas {
 
       const std::string& source_ip_port() const { return _impl->source_ip_port; }
 
+      // the caller can decompress the response
+      bool accept_compressed() const { return _impl->flags & header_flags::accept_compressed; }
+
+      void set_responder(remote_caller* responder) {
+        if (_impl.use_count() > 1) _impl = atlas::make_pooled<__rpc_context>(*_impl);
+        _impl->responder = responder;
+      }
+
+      // nullptr if there is no way to talk back to the caller
+      remote_caller* responder() const { return _impl ? _impl->responder : nullptr; }
+
     private:
 
       std::shared_ptr<__rpc_context> _impl;
@@ -209,6 +215,147 @@ namespace atlas {
     // constant null value
     const rpc_context nilctx(nullptr);
 
+    // the context is a placeholder in the argument list, it's filled by the callee
+    template<>
+    struct codec<rpc_context> {
+      static void encode(codec_writer& w, const rpc_context& c) {}
+
+      static void decode(codec_reader& r, rpc_context& c) {}
+    };
+
+    // a remote function decodes it's arguments from the message, and then runs with the local context
+    typedef rpc_result (*remote_function_type)(codec_reader&, const rpc_context&);
+
+    template<typename Functor, Functor f>
+    struct remote_function {
+      // throw codec_error
+      static rpc_result invoke(codec_reader& r, const rpc_context& c) {
+        rf_wrapper<typename std::remove_pointer<Functor>::type> rpc(f, r, c);
+        return rpc();
+      }
+    };
+
+    /*
+     * Remote functions indexed by function id, filled by ATLAS_REGISTER_REMOTE_FUNC at static
+     * initialization time, so a look up is a single indexed load.
+     *
+     * The table is a zero initialized static array, it's ready before any dynamic initialization,
+     * so the registering order of the translation units does not matter.
+     *
+     * A function registered inline_safe is cheap and never blocks, the server runs it right in the
+     * IO thread which receives it, rather than queueing it to a worker. The other ones are queued
+     * with the priority of their flags : high for the control traffic, low for the bulk work.
+     * */
+    template<typename Tag = void>
+    class basic_function_table {
+    public:
+
+      // builtin functions take the negative ids
+      static const int min_fn_id = -64;
+      static const int max_fn_id = 4095;
+
+      enum flag_type { inline_safe = 1, high_priority = 2, low_priority = 4 };
+
+      // 0 is the highest one
+      enum priority_type { high = 0, normal, low };
+
+      struct entry {
+        remote_function_type fn;
+        const char* name;
+        unsigned flags;
+      };
+
+    public:
+
+      // throw std::logic_error if the id is out of range, or is taken by another function
+      static bool regist(int fn_id, const char* name, remote_function_type fn, unsigned flags = 0) {
+        if (fn_id < min_fn_id || fn_id > max_fn_id) {
+          throw std::logic_error(std::string("remote function id out of range : ") + name
+              + " -> " + std::to_string(fn_id));
+        }
+
+        entry& e = _entries[fn_id - min_fn_id];
+        // the same registering might be seen by several translation units
+        if (e.fn && e.fn != fn) {
+          throw std::logic_error(std::string("duplicated remote function id ") + std::to_string(fn_id)
+              + " : " + e.name + ", " + name);
+        }
+
+        e.fn = fn;
+        e.name = name;
+        e.flags = flags;
+
+        return true;
+      }
+
+      static unsigned flags(int fn_id) {
+        if (fn_id < min_fn_id || fn_id > max_fn_id) return 0;
+
+        return _entries[fn_id - min_fn_id].flags;
+      }
+
+      // an application changes the flags at start up, before any request arrives
+      static void set_flags(int fn_id, unsigned flags) {
+        if (fn_id < min_fn_id || fn_id > max_fn_id) return;
+
+        _entries[fn_id - min_fn_id].flags = flags;
+      }
+
+      static bool is_inline_safe(int fn_id) {
+        if (fn_id < min_fn_id || fn_id > max_fn_id) return false;
+
+        return _entries[fn_id - min_fn_id].flags & inline_safe;
+      }
+
+      static priority_type priority_of(int fn_id) {
+        if (fn_id < min_fn_id || fn_id > max_fn_id) return normal;
+
+        unsigned flags = _entries[fn_id - min_fn_id].flags;
+        if (flags & high_priority) return high;
+        if (flags & low_priority) return low;
+
+        return normal;
+      }
+
+      static remote_function_type find(int fn_id) {
+        if (fn_id < min_fn_id || fn_id > max_fn_id) return nullptr;
+
+        return _entries[fn_id - min_fn_id].fn;
+      }
+
+      static const char* name(int fn_id) {
+        if (fn_id < min_fn_id || fn_id > max_fn_id) return nullptr;
+
+        return _entries[fn_id - min_fn_id].name;
+      }
+
+    private:
+
+      static entry _entries[max_fn_id - min_fn_id + 1];
+    };
+
+    template<typename Tag>
+    typename basic_function_table<Tag>::entry basic_function_table<Tag>::_entries[max_fn_id - min_fn_id + 1];
+
+    typedef basic_function_table<> function_table;
+
+// Register owner::func_name as the remote function func_id with the flags, and define fn_ids::func_name
+// must be placed in the namespace where the owner is visible
+#define ATLAS_REGISTER_REMOTE_FUNC_FLAGS(owner, func_name, func_id, flags) namespace fn_ids { \
+    static const int func_name = func_id; \
+    static const bool func_name##_registered = ::atlas::rpc::function_table::regist(func_id, #func_name, \
+        &::atlas::rpc::remote_function<decltype(&owner::func_name), &owner::func_name>::invoke, flags); \
+};
+
+#define ATLAS_REGISTER_REMOTE_FUNC(owner, func_name, func_id) \
+    ATLAS_REGISTER_REMOTE_FUNC_FLAGS(owner, func_name, func_id, 0)
+
+// the function runs in the IO thread which receives it, it must be cheap and must not block
+// it's queued with the high priority if the flag is cleared
+#define ATLAS_REGISTER_INLINE_REMOTE_FUNC(owner, func_name, func_id) \
+    ATLAS_REGISTER_REMOTE_FUNC_FLAGS(owner, func_name, func_id, \
+        ::atlas::rpc::function_table::inline_safe | ::atlas::rpc::function_table::high_priority)
+
     class builtin_rfc {
     public:
 
@@ -219,15 +366,34 @@ namespace atlas {
       }
 
       static rpc_result resume_task(const uuid& sid, const rpc_result& result, const rpc_context& c) noexcept {
-        async_task_manager::ref().resume(sid, result.data(), result.err());
+        // the call is done, it's timer goes
+        uint64_t timer = async_task_manager::ref().resume(sid, result.data(), result.err());
+        if (timer) timeout_manager::ref().cancel(timer);
+
+        return nullptr;
+      }
+
+      // a chunk of a stream arrives at the receiver, defined after remote_caller
+      static rpc_result stream_chunk(const uuid& sid, int64_t seq, const std::string& chunk, int err, bool last,
+          const rpc_context& c);
+
+      // the receiver gives credits back to the sender
+      static rpc_result stream_credit(const uuid& sid, int credits, const rpc_context& c) noexcept {
+        stream_manager::ref().grant(sid, credits);
 
         return nullptr;
       }
     };
 
     // builtin rpc
-    ATLAS_REGISTER_REMOTE_FUNC(resume_thread, -1);
-    ATLAS_REGISTER_REMOTE_FUNC(resume_task, -2);
+    // the results run inline : waking a thread is cheap, and so must be the callbacks, an application
+    // with slow callbacks clears the inline flag of resume_task
+    // a stream writer holds a worker until the credits arrive, the credits must not wait behind it
+    // the chunks are bulk data, they wait behind the requests and the responses, not the other way round
+    ATLAS_REGISTER_INLINE_REMOTE_FUNC(builtin_rfc, resume_thread, -1);
+    ATLAS_REGISTER_INLINE_REMOTE_FUNC(builtin_rfc, resume_task, -2);
+    ATLAS_REGISTER_REMOTE_FUNC_FLAGS(builtin_rfc, stream_chunk, -3, function_table::low_priority);
+    ATLAS_REGISTER_INLINE_REMOTE_FUNC(builtin_rfc, stream_credit, -4);
 
   } // rpc
 } // atlas
@@ -274,7 +440,10 @@ namespace atlas {
     class message_builder {
     public:
 
-      message_builder(int client) : _client_id(client), _return_type(rpc_async_no_callback) {}
+      message_builder(int client) :
+        _client_id(client), _return_type(rpc_async_no_callback), _compression(true), _deadline(no_deadline),
+        _timeout(0)
+      {}
 
     public:
 
@@ -282,37 +451,96 @@ namespace atlas {
 
       void set_return_type(return_type rt) { _return_type = rt; }
 
+      // compress large bodies, on by default
+      void set_compression(bool on) { _compression = on; }
+
+      void set_deadline(const deadline_type& d) { _deadline = d; }
+
+      // every call gets a deadline of now + timeout, zero means no timeout
+      void set_timeout(std::chrono::microseconds timeout) { _timeout = timeout; }
+
+      /*
+       * The earliest of the deadline, the timeout, and the deadline inherited from the request
+       * this thread is executing. To give a single call a deadline, put it in a deadline_scope.
+       * */
+      deadline_type deadline() const {
+        deadline_type d = std::min(_deadline, current_deadline());
+        if (_timeout.count() > 0) d = std::min(d, deadline_clock::now() + _timeout);
+
+        return d;
+      }
+
+      // large enough for the header and the arguments of most calls
+      static const size_t default_message_capacity = 256;
+
+      // smaller bodies are not worth compressing
+      static const size_t compress_threshold = 1024;
+
+      /*
+       * The header and the arguments are encoded into a single preallocated buffer,
+       * a body larger than compress_threshold is compressed if it saves at least 1/8 of the size
+       * */
       template<typename Functor, typename ... Args>
       std::string build(Functor f, int fn_id, Args&&... args) {
-        typedef typename std::result_of<Functor(Args&&...)>::type result_type;
+        return build_for(session_id_generator::next(), f, fn_id, std::forward<Args>(args)...);
+      }
+
+      // build the message of a call whose session id is given by the pending call table
+      template<typename Functor, typename ... Args>
+      std::string build_for(const uuid& session_id, Functor f, int fn_id, Args&&... args) {
+        std::string message;
+        build_into(message, session_id, f, fn_id, std::forward<Args>(args)...);
 
-        _session_id = random_generator()();
+        return message;
+      }
+
+      // build the message into a buffer, a message_buffer for example, whose capacity is reused
+      template<typename Functor, typename ... Args>
+      void build_into(std::string& message, const uuid& session_id, Functor f, int fn_id, Args&&... args) {
+        _session_id = session_id;
         request_header header = message::make_header(fn_id, _session_id);
         header.client_id = _client_id;
         header.return_type = _return_type;
+        header.budget = to_budget(deadline());
 
-        std::ostringstream oss;
-        std::string header_str(reinterpret_cast<char*>(&header), sizeof(header));
+        message.clear();
+        message.reserve(default_message_capacity);
+        message.append(reinterpret_cast<const char*>(&header), sizeof(header));
 
-        rpc_oarchive oa(oss);
-        rf_wrapper<result_type(Args...)> rpc(f, std::forward<Args>(args)..., oa);
+        codec_writer writer(message);
+        argument_codec<Functor>::encode(writer, args...);
 
-        std::string body = oss.str();
-        std::string message(header_str);
-        message += body;
+        if (_compression && message.size() - sizeof(header) >= compress_threshold) {
+          compress(message);
+        }
 
-        // std::cout << body;
-
-        auto h = reinterpret_cast<request_header*>(const_cast<char*>(message.data()));
+        auto h = reinterpret_cast<request_header*>(&message[0]);
         h->length = message.size();
+      }
 
-        return std::move(message);
+    private:
+
+      static void compress(std::string& message) {
+        const size_t body_size = message.size() - sizeof(request_header);
+
+        std::string packed;
+        packed.reserve(sizeof(request_header) + lz::max_compressed_size(body_size));
+        packed.append(message.data(), sizeof(request_header));
+        lz::compress(message.data() + sizeof(request_header), body_size, packed);
+
+        if (packed.size() + body_size / 8 > message.size()) return;
+
+        reinterpret_cast<request_header*>(&packed[0])->flags |= body_compressed;
+        message.swap(packed);
       }
 
     private:
 
       int _client_id;
       return_type _return_type;
+      bool _compression;
+      deadline_type _deadline;
+      std::chrono::microseconds _timeout;
       uuid _session_id;
     };
 
@@ -328,6 +556,21 @@ namespace atlas {
 
     public:
 
+      // the number of responses a call with a callback waits for
+      void set_response_expected(int n) { _response_expected = n; }
+
+      // compress the large messages sent by this caller, on by default
+      void set_compression(bool on) { _message_builder.set_compression(on); }
+
+      // the callee drops the calls not started before the deadline
+      void set_deadline(const deadline_type& d) { _message_builder.set_deadline(d); }
+
+      // every call made by this caller must start within the timeout
+      template<typename Rep, typename Period>
+      void set_timeout(const std::chrono::duration<Rep, Period>& timeout) {
+        _message_builder.set_timeout(std::chrono::duration_cast<std::chrono::microseconds>(timeout));
+      }
+
       /*
        * 1) Serialize a remote function call with it's arguments,
        * 2) send the message to the target using the derived class's implementation
@@ -336,7 +579,9 @@ namespace atlas {
       void call(Functor f, int fn_id, Args ... args) {
         _message_builder.set_return_type(rpc_async_no_callback);
 
-        send(_message_builder.build(f, fn_id, std::forward<Args>(args)...));
+        message_buffer buffer;
+        _message_builder.build_into(buffer.str(), session_id_generator::next(), f, fn_id, std::forward<Args>(args)...);
+        send(buffer.str());
       }
 
       /*
@@ -345,32 +590,135 @@ namespace atlas {
        * 3) register the callback for the returning
        * 4) send the message to the target using the derived class's implementation
        * 5) the server should issue a resume_task function call and then the client
-       *    calls the callback
+       *    calls the callback, once response_expected responses arrive
+       *
+       * Returns the session id of the call, to cancel it
        * */
       template<typename Functor, typename ... Args>
-      void call(Functor f, int fn_id, rpc_callback_type cb, Args ... args) {
+      uuid call(Functor f, int fn_id, rpc_callback_type cb, Args ... args) {
+        return call_reduce(f, fn_id, nullptr, cb, std::forward<Args>(args)...);
+      }
+
+      /*
+       * A fan out call, every response is folded into the result by the reducer, and the callback
+       * gets the result once response_expected responses arrive, see completion
+       * */
+      template<typename Functor, typename ... Args>
+      uuid call_reduce(Functor f, int fn_id, rpc_reducer_type reducer, rpc_callback_type cb, Args ... args) {
         _message_builder.set_return_type(rpc_async_callback);
 
-        std::string message = _message_builder.build(f, fn_id, std::forward<Args>(args)...);
-        async_task_manager::ref().suspend(_message_builder.session_id(), cb, _response_expected);
+        uuid sid = async_task_manager::ref().suspend(cb, _response_expected, reducer);
+
+        // the callback gets errc::timeout if the responses do not come in time, the timer is known
+        // to the task before the request is sent, so the response always finds it to cancel
+        async_task_manager::ref().set_timer(sid, timeout_manager::ref().schedule(sid, _message_builder.deadline()));
+
+        try {
+          message_buffer buffer;
+          _message_builder.build_into(buffer.str(), sid, f, fn_id, std::forward<Args>(args)...);
+          send(buffer.str());
+        }
+        catch (...) {
+          cancel(sid);
+          throw;
+        }
 
-        send(message);
+        return sid;
+      }
+
+      // the callback of the call never runs, and it's responses are dropped
+      bool cancel(const uuid& sid) {
+        uint64_t timer = 0;
+        if (!async_task_manager::ref().cancel(sid, &timer)) return false;
+
+        if (timer) timeout_manager::ref().cancel(timer);
+        return true;
       }
 
       /*
-       * The remote_caller thread will be blocked to wait for the result
+       * Like the call with a callback, but returns a future of the result, the future is ready
+       * when the response arrives, or with errc::timeout if it does not come in time.
+       * */
+      template<typename Functor, typename ... Args>
+      rpc_future call_async(Functor f, int fn_id, Args ... args) {
+        rpc_promise promise;
+        rpc_future future = promise.get_future();
+
+        call(f, fn_id, rpc_callback_type([promise](const std::string& data, int err, async_task& task) {
+          promise.set_value(rpc_result(data, err));
+        }), std::forward<Args>(args)...);
+
+        return future;
+      }
+
+      /*
+       * The remote_caller thread will be blocked to wait for the result, until the deadline of the
+       * call, the result is errc::timeout if the response does not come in time.
+       *
+       * The response is delivered by another thread, never make a sync call in an IO thread.
        * */
       template<typename Functor, typename ... Args>
       rpc_result sync_call(Functor f, int fn_id, Args ... args) {
-        typedef typename std::result_of<Functor(Args...)>::type result_type;
         _message_builder.set_return_type(rpc_sync);
 
-        std::string message = _message_builder.build(f, fn_id, std::forward<Args>(args)...);
-        rpc_result rr = sync_task_manager::ref().suspend(_message_builder.session_id());
+        // register the waiter before the request leaves, the response may come back at once
+        sync_waiter& waiter = sync_waiter::local();
+        waiter.reset();
+        uuid sid = sync_task_manager::ref().suspend(&waiter);
+
+        try {
+          message_buffer buffer;
+          _message_builder.build_into(buffer.str(), sid, f, fn_id, std::forward<Args>(args)...);
+          send(buffer.str());
+        }
+        catch (...) {
+          if (!sync_task_manager::ref().remove(sid)) waiter.wait();
+          throw;
+        }
+
+        if (!waiter.wait_until(timeout_manager::expiry_of(_message_builder.deadline()))) {
+          if (sync_task_manager::ref().remove(sid)) return rpc_result("", error_value(errc::timeout));
+
+          // lost the race, the response is being delivered
+          waiter.wait();
+        }
+
+        return rpc_result(waiter.data(), waiter.err());
+      }
 
-        send(message);
+      /*
+       * Server streaming : the remote function writes chunks with a stream_writer, and cb is called
+       * for every chunk as it arrives
+       * */
+      template<typename Functor, typename ... Args>
+      void call_stream(Functor f, int fn_id, stream_callback_type cb, Args ... args) {
+        _message_builder.set_return_type(rpc_stream);
+
+        message_buffer buffer;
+        _message_builder.build_into(buffer.str(), session_id_generator::next(), f, fn_id, std::forward<Args>(args)...);
+        stream_manager::ref().open_receiver(_message_builder.session_id(), cb);
+        timeout_manager::ref().watch_stream(_message_builder.session_id());
+
+        send(buffer.str());
+      }
+
+      /*
+       * Client streaming : call the remote function which accepts the stream, see accept_stream,
+       * and return the stream id, then write the chunks with a stream_writer on this caller.
+       * The writer blocks until the remote side grants the first credits.
+       * */
+      template<typename Functor, typename ... Args>
+      uuid open_stream(Functor f, int fn_id, Args ... args) {
+        _message_builder.set_return_type(rpc_stream);
+
+        message_buffer buffer;
+        _message_builder.build_into(buffer.str(), session_id_generator::next(), f, fn_id, std::forward<Args>(args)...);
+        uuid sid = _message_builder.session_id();
+        stream_manager::ref().open_sender(sid, 0);
 
-        return std::move(rr);
+        send(buffer.str());
+
+        return sid;
       }
 
     protected:
@@ -392,6 +740,104 @@ namespace atlas {
       int _response_expected;
     };
 
+    inline rpc_result builtin_rfc::stream_chunk(const uuid& sid, int64_t seq, const std::string& chunk, int err,
+        bool last, const rpc_context& c) {
+      int credits = stream_manager::ref().receive(sid, seq, chunk, err, last);
+
+      if (credits > 0 && c.responder()) {
+        c.responder()->call(builtin_rfc::stream_credit, fn_ids::stream_credit, sid, credits, nilctx);
+      }
+
+      return nullptr;
+    }
+
+    /*
+     * Writes the chunks of a stream, blocks while the receiver is out of credits.
+     *
+     * On the server side, a streaming remote function creates the writer from it's context and
+     * returns nullptr once it's done, the writer must not outlive the function call.
+     * On the client side, the writer is created on the caller which opened the stream.
+     * */
+    class stream_writer {
+    public:
+
+      // server streaming
+      stream_writer(const rpc_context& c,
+          std::chrono::milliseconds timeout = std::chrono::milliseconds(stream_manager::stream_timeout_ms))
+        : _caller(c.responder()), _session_id(c.session_id()), _timeout(timeout), _seq(0), _closed(false)
+      {
+        stream_manager::ref().open_sender(_session_id, stream_manager::stream_window);
+      }
+
+      // client streaming, the sender is opened by remote_caller::open_stream
+      stream_writer(remote_caller& caller, const uuid& sid,
+          std::chrono::milliseconds timeout = std::chrono::milliseconds(stream_manager::stream_timeout_ms))
+        : _caller(&caller), _session_id(sid), _timeout(timeout), _seq(0), _closed(false)
+      {}
+
+      stream_writer(const stream_writer&) = delete;
+      stream_writer& operator=(const stream_writer&) = delete;
+
+      ~stream_writer() { close(); }
+
+    public:
+
+      // return false if the stream is closed, or the receiver gives no credit in time
+      bool write(const std::string& chunk) {
+        if (_closed || !_caller) return false;
+
+        // the receiver is gone or stalled, tell it that the stream is broken
+        if (!stream_manager::ref().acquire(_session_id, _timeout)) {
+          close(-1);
+          return false;
+        }
+
+        _caller->call(builtin_rfc::stream_chunk, fn_ids::stream_chunk, _session_id, _seq++, chunk, 0, false, nilctx);
+
+        return true;
+      }
+
+      // send the final chunk, which needs no credit
+      void close(int err = 0) noexcept {
+        if (_closed) return;
+        _closed = true;
+
+        try {
+          if (_caller) {
+            _caller->call(builtin_rfc::stream_chunk, fn_ids::stream_chunk, _session_id, _seq++, std::string(), err,
+                true, nilctx);
+          }
+        }
+        catch (...) {
+          // the receiver will not see the end of the stream, nothing more we can do here
+        }
+
+        stream_manager::ref().close_sender(_session_id);
+      }
+
+    private:
+
+      remote_caller* _caller;
+      uuid _session_id;
+      std::chrono::milliseconds _timeout;
+      int64_t _seq;
+      bool _closed;
+    };
+
+    /*
+     * Called by the remote function opened with remote_caller::open_stream, cb is called for every
+     * chunk the caller writes
+     * */
+    inline void accept_stream(const rpc_context& c, stream_callback_type cb) {
+      stream_manager::ref().open_receiver(c.session_id(), cb);
+      timeout_manager::ref().watch_stream(c.session_id());
+
+      if (c.responder()) {
+        c.responder()->call(builtin_rfc::stream_credit, fn_ids::stream_credit, c.session_id(),
+            static_cast<int>(stream_manager::stream_window), nilctx);
+      }
+    }
+
 
   } // rpc
 } // atlas
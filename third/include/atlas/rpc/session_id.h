@@ -0,0 +1,106 @@
+/*
+ * session_id.h
+ *
+ *  Created on: Oct 17, 2013
+ *      Author: Vincent Zhang, ivincent.zhang@gmail.com
+ */
+
+/*    Copyright 2011 ~ 2013 Vincent Zhang, ivincent.zhang@gmail.com
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef ATLAS_RPC_SESSION_ID_H_
+#define ATLAS_RPC_SESSION_ID_H_
+
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+#include <random>
+
+#include <boost/uuid/uuid.hpp>
+
+namespace atlas {
+  namespace rpc {
+
+    using boost::uuids::uuid;
+
+    /*
+     * Session ids must be unique in the whole cluster, they are packed into the 16 bytes of an uuid :
+     *
+     *   [0, 8)  node id, drawn from std::random_device once per process
+     *   [8, 16) sequence number, unique inside the process
+     *
+     * Every thread reserves a block of sequence numbers from a shared counter, so most ids cost
+     * a thread local increment, instead of seeding a new random engine per id.
+     * */
+    class session_id_generator {
+    public:
+
+      static const uint64_t block_size = 1 << 16;
+
+    public:
+
+      static uuid next() {
+        static thread_local uint64_t sequence = 0;
+        static thread_local uint64_t limit = 0;
+
+        if (sequence == limit) {
+          sequence = reserve();
+          limit = sequence + block_size;
+        }
+
+        return make(node_id(), sequence++);
+      }
+
+      static uuid make(uint64_t node, uint64_t sequence) {
+        uuid id;
+        std::memcpy(id.data, &node, sizeof(node));
+        std::memcpy(id.data + sizeof(node), &sequence, sizeof(sequence));
+        return id;
+      }
+
+      static uint64_t node_of(const uuid& id) {
+        uint64_t node = 0;
+        std::memcpy(&node, id.data, sizeof(node));
+        return node;
+      }
+
+      static uint64_t sequence_of(const uuid& id) {
+        uint64_t sequence = 0;
+        std::memcpy(&sequence, id.data + sizeof(sequence), sizeof(sequence));
+        return sequence;
+      }
+
+      static uint64_t node_id() {
+        static const uint64_t id = generate_node_id();
+        return id;
+      }
+
+    private:
+
+      static uint64_t reserve() {
+        static std::atomic<uint64_t> next_block(0);
+        return next_block.fetch_add(block_size, std::memory_order_relaxed);
+      }
+
+      static uint64_t generate_node_id() {
+        std::random_device rd;
+        return (static_cast<uint64_t>(rd()) << 32) ^ rd();
+      }
+    };
+
+  } // rpc
+} // atlas
+
+#endif /* ATLAS_RPC_SESSION_ID_H_ */
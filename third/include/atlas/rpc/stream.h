@@ -0,0 +1,274 @@
+/*
+ * stream.h
+ *
+ *  Created on: Oct 17, 2013
+ *      Author: Vincent Zhang, ivincent.zhang@gmail.com
+ */
+
+/*    Copyright 2011 ~ 2013 Vincent Zhang, ivincent.zhang@gmail.com
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef ATLAS_RPC_STREAM_H_
+#define ATLAS_RPC_STREAM_H_
+
+#include <cstdint>
+#include <map>
+#include <string>
+#include <mutex>
+#include <memory>
+#include <tuple>
+#include <chrono>
+#include <functional>
+#include <condition_variable>
+
+#include <boost/uuid/uuid.hpp>
+
+#include <atlas/singleton.h>
+#include <atlas/rpc/deadline.h>
+
+namespace atlas {
+  namespace rpc {
+
+    using boost::uuids::uuid;
+
+    // called for every chunk of a stream, in order, last is true for the final chunk
+    typedef std::function<void(const std::string& chunk, int err, bool last)> stream_callback_type;
+
+    /*
+     * The state of the streams of this process, indexed by session id.
+     *
+     * A stream moves chunks from a sender to a receiver under credit based flow control : the sender
+     * spends a credit for every chunk, and blocks when it runs out of credits. The receiver gives
+     * the credits back once the chunks are consumed, so at most stream_window chunks of a stream
+     * are in flight, or buffered, at any time.
+     *
+     * A stream idle for stream_timeout_ms is broken : the sender gives up waiting for credits, and
+     * the receiver is closed by timeout_manager, see expire_receiver.
+     * */
+    class stream_manager : public atlas::singleton<stream_manager> {
+    public:
+
+      // the credits a receiver grants when a stream opens
+      static const int stream_window = 16;
+
+      // enumerator rather than static constant, std::chrono takes it by reference
+      enum { stream_timeout_ms = 30 * 1000 };
+
+    private:
+
+      struct receiver {
+        receiver(stream_callback_type cb) :
+          cb(cb), next_seq(0), consumed(0), closed(false), last_active(deadline_clock::now()) {}
+
+        std::mutex mutex;
+        stream_callback_type cb;
+        int64_t next_seq;
+        int consumed;
+        bool closed;
+        deadline_type last_active;
+        // chunks arrived ahead of their turn, bounded by the window
+        std::map<int64_t, std::tuple<std::string, int, bool>> pending;
+      };
+
+      struct sender {
+        sender(int credits) : credits(credits), closed(false) {}
+
+        std::mutex mutex;
+        std::condition_variable cv;
+        int credits;
+        bool closed;
+      };
+
+      typedef std::shared_ptr<receiver> receiver_ptr;
+      typedef std::shared_ptr<sender> sender_ptr;
+
+    public:
+
+      /// receiver side
+
+      void open_receiver(const uuid& id, stream_callback_type cb) {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _receivers[id] = std::make_shared<receiver>(cb);
+      }
+
+      /*
+       * Deliver the chunks in order, and return the credits to give back to the sender,
+       * return -1 if the stream is unknown
+       * */
+      int receive(const uuid& id, int64_t seq, const std::string& chunk, int err, bool last) {
+        receiver_ptr r;
+
+        {
+          std::lock_guard<std::mutex> guard(_mutex);
+          auto it = _receivers.find(id);
+          if (it == _receivers.end()) return -1;
+
+          r = it->second;
+        }
+
+        std::lock_guard<std::mutex> guard(r->mutex);
+
+        // expired in the meantime
+        if (r->closed) return -1;
+
+        r->last_active = deadline_clock::now();
+
+        if (seq != r->next_seq) {
+          r->pending.insert(std::make_pair(seq, std::make_tuple(chunk, err, last)));
+          return 0;
+        }
+
+        bool finished = deliver(*r, chunk, err, last);
+
+        auto it = r->pending.begin();
+        while (!finished && it != r->pending.end() && it->first == r->next_seq) {
+          finished = deliver(*r, std::get<0>(it->second), std::get<1>(it->second), std::get<2>(it->second));
+          it = r->pending.erase(it);
+        }
+
+        if (finished) {
+          r->closed = true;
+          close_receiver(id);
+          return 0;
+        }
+
+        // give the credits back in batches
+        if (r->consumed < stream_window / 2) return 0;
+
+        int credits = r->consumed;
+        r->consumed = 0;
+        return credits;
+      }
+
+      void close_receiver(const uuid& id) {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _receivers.erase(id);
+      }
+
+      /*
+       * Close the receiver with a final err if no chunk arrived for stream_timeout_ms, otherwise
+       * set next to the time it expires if it stays idle from now on.
+       *
+       * Return true if the receiver is still open
+       * */
+      bool expire_receiver(const uuid& id, int err, deadline_type& next) {
+        receiver_ptr r;
+
+        {
+          std::lock_guard<std::mutex> guard(_mutex);
+          auto it = _receivers.find(id);
+          if (it == _receivers.end()) return false;
+
+          r = it->second;
+        }
+
+        std::lock_guard<std::mutex> guard(r->mutex);
+        if (r->closed) return false;
+
+        next = r->last_active + std::chrono::milliseconds(stream_timeout_ms);
+        if (next > deadline_clock::now()) return true;
+
+        r->closed = true;
+        close_receiver(id);
+
+        if (r->cb) r->cb(std::string(), err, true);
+
+        return false;
+      }
+
+      /// sender side
+
+      void open_sender(const uuid& id, int credits) {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _senders[id] = std::make_shared<sender>(credits);
+      }
+
+      // spend a credit, wait at most timeout for one, return false if timeout or the stream is closed
+      bool acquire(const uuid& id, std::chrono::milliseconds timeout) {
+        sender_ptr s = find_sender(id);
+        if (!s) return false;
+
+        std::unique_lock<std::mutex> lock(s->mutex);
+        if (!s->cv.wait_for(lock, timeout, [&s]() { return s->credits > 0 || s->closed; })) return false;
+        if (s->closed) return false;
+
+        --s->credits;
+        return true;
+      }
+
+      void grant(const uuid& id, int credits) {
+        sender_ptr s = find_sender(id);
+        if (!s) return;
+
+        {
+          std::lock_guard<std::mutex> guard(s->mutex);
+          s->credits += credits;
+        }
+
+        s->cv.notify_one();
+      }
+
+      // wake up the blocked writer, if any
+      void close_sender(const uuid& id) {
+        sender_ptr s;
+
+        {
+          std::lock_guard<std::mutex> guard(_mutex);
+          auto it = _senders.find(id);
+          if (it == _senders.end()) return;
+
+          s = it->second;
+          _senders.erase(it);
+        }
+
+        {
+          std::lock_guard<std::mutex> guard(s->mutex);
+          s->closed = true;
+        }
+
+        s->cv.notify_all();
+      }
+
+    private:
+
+      bool deliver(receiver& r, const std::string& chunk, int err, bool last) {
+        ++r.next_seq;
+        ++r.consumed;
+
+        if (r.cb) r.cb(chunk, err, last);
+
+        return last;
+      }
+
+      sender_ptr find_sender(const uuid& id) {
+        std::lock_guard<std::mutex> guard(_mutex);
+
+        auto it = _senders.find(id);
+        if (it == _senders.end()) return nullptr;
+
+        return it->second;
+      }
+
+    private:
+
+      std::mutex _mutex;
+      std::map<uuid, receiver_ptr> _receivers;
+      std::map<uuid, sender_ptr> _senders;
+    };
+
+  } // rpc
+} // atlas
+
+#endif /* ATLAS_RPC_STREAM_H_ */
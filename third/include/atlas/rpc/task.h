@@ -23,16 +23,22 @@
 #ifndef ATLAS_RPC_TASK_H_
 #define ATLAS_RPC_TASK_H_
 
+#include <cstdint>
 #include <map>
+#include <memory>
+#include <vector>
 #include <string>
 #include <mutex>
+#include <utility>
 #include <functional>
-#include <future>
 
 #include <boost/uuid/uuid.hpp>
 
 #include <atlas/singleton.h>
+#include <atlas/object_pool.h>
 #include <atlas/rpc/result.h>
+#include <atlas/rpc/pending.h>
+#include <atlas/rpc/waiter.h>
 
 namespace atlas {
   namespace rpc {
@@ -42,43 +48,59 @@ namespace atlas {
     class async_task;
     typedef std::function<void(const std::string&, int, async_task& task)> rpc_callback_type;
 
+    // fold a response into the accumulated result of a fan out call
+    typedef std::function<void(std::string& acc, const std::string& data, int err)> rpc_reducer_type;
+
+    // the number of responses a fan out call to n nodes waits for
+    struct completion {
+      static int all(int n) { return n; }
+
+      static int quorum(int n) { return n / 2 + 1; }
+
+      static int first(int k) { return k; }
+    };
+
     struct __async_task {
 
-      __async_task(rpc_callback_type cb = nullptr, int response_received = 1, int response_expected = 0)
-        : cb(cb), response_received(response_received), response_expected(response_expected), record_count(0) {}
+      __async_task(rpc_callback_type cb = nullptr, int response_expected = 1, rpc_reducer_type reducer = nullptr)
+        : cb(cb), reducer(reducer), response_received(0), response_expected(response_expected), record_count(0), err(0) {}
 
       __async_task(const __async_task& d)
-        : cb(d.cb), response_received(d.response_received), response_expected(d.response_expected),
-          record_count(0), data_list(d.data_list) {}
+        : cb(d.cb), reducer(d.reducer), response_received(d.response_received), response_expected(d.response_expected),
+          record_count(0), err(d.err), acc(d.acc), data_list(d.data_list) {}
 
       rpc_callback_type cb;
+      rpc_reducer_type reducer;
       int response_received;
       int response_expected;
       size_t record_count;
+      int err;
+      std::string acc;
       std::vector<std::string> data_list;
     };
 
+    /*
+     * The state of an async call : it collects the responses until response_expected of them
+     * arrive, then the callback runs once. With a reducer, every response is folded into an
+     * accumulated result, which is what the callback gets, otherwise the responses of a fan out
+     * call are kept in the data list, and the callback gets the last one. The response of a call
+     * which expects only one goes straight to the callback, it is not copied.
+     * */
     class async_task {
     public:
 
       async_task(std::nullptr_t) {}
 
-      async_task(rpc_callback_type cb = nullptr, int response_received = 1)
-        : _pimpl(new __async_task(cb, response_received)) {}
+      async_task(rpc_callback_type cb = nullptr, int response_expected = 1, rpc_reducer_type reducer = nullptr)
+        : _pimpl(atlas::make_pooled<__async_task>(cb, response_expected, reducer)) {}
 
       async_task(const async_task& task) :
-        _pimpl(new __async_task(*task._pimpl))
+        _pimpl(atlas::make_pooled<__async_task>(*task._pimpl))
       {}
 
       async_task& operator=(const async_task& task) {
         if (std::addressof(task) != this) {
-          _pimpl.reset(new __async_task());
-
-          _pimpl->cb = task._pimpl->cb;
-          _pimpl->response_received = task._pimpl->response_received;
-          _pimpl->response_received = task._pimpl->response_received;
-          _pimpl->record_count = task._pimpl->record_count;
-          _pimpl->data_list = task._pimpl->data_list;
+          _pimpl = atlas::make_pooled<__async_task>(*task._pimpl);
         }
 
         return *this;
@@ -96,15 +118,35 @@ namespace atlas {
 
       void increase_response() { ++_pimpl->response_received; }
 
-      bool ready() const { return _pimpl->response_received == _pimpl->response_received; }
+      bool ready() const { return _pimpl->response_received >= _pimpl->response_expected; }
+
+      // take a response into account, the last error is kept
+      void reduce(const std::string& data, int err) {
+        increase_response();
+        if (err) _pimpl->err = err;
+
+        if (_pimpl->reducer) _pimpl->reducer(_pimpl->acc, data, err);
+        else if (_pimpl->response_expected > 1) put_data(data);
+      }
+
+      // run the callback with the result reduced so far, or with the response which completes the task
+      void complete(int err, const std::string* last = nullptr) {
+        if (!_pimpl->cb) return;
+
+        if (_pimpl->reducer) _pimpl->cb(_pimpl->acc, err, *this);
+        else if (last) _pimpl->cb(*last, err, *this);
+        else _pimpl->cb(_pimpl->data_list.empty() ? std::string() : _pimpl->data_list.back(), err, *this);
+      }
 
       void run(const std::string& result, int err) {
         if (_pimpl->cb) _pimpl->cb(result, err, *this);
       }
 
+      int err() const { return _pimpl->err; }
+
       void put_data(const std::string& data) { _pimpl->data_list.push_back(data); }
 
-      void put_data(std::string&& data) { _pimpl->data_list.push_back(data); }
+      void put_data(std::string&& data) { _pimpl->data_list.push_back(std::move(data)); }
 
       size_t response_count() const { return _pimpl->response_received; }
 
@@ -121,6 +163,7 @@ namespace atlas {
         return result; // NRVO
       }
 
+      // the responses of a fan out call, the response of a single call is not kept
       const std::vector<std::string>& data_list() const { return _pimpl->data_list; }
 
     private:
@@ -136,80 +179,126 @@ namespace atlas {
     class sync_task_manager : public atlas::singleton<sync_task_manager> {
     public:
 
-      typedef std::shared_ptr<std::promise<rpc_result>> promise_ptr;
+      // register the waiter of the calling thread, and return the session id of the call
+      uuid suspend(sync_waiter* waiter) {
+        return _waiters.insert(waiter);
+      }
 
-    public:
+      void resume(const uuid& id, const std::string& result, int err_code = 0) {
+        sync_waiter* waiter = nullptr;
+        if (!_waiters.erase(id, &waiter)) return;
 
-      rpc_result suspend(const uuid& id) {
-        promise_ptr promise(new std::promise<rpc_result>());
+        waiter->notify(result, err_code);
+      }
 
-        {
-          std::lock_guard<std::mutex> guard(_mutex);
-          _promises.insert(std::make_pair(id, promise));
-        }
+      // return false if the call is already being resumed
+      bool remove(const uuid& id) { return _waiters.erase(id); }
 
-        std::future<rpc_result> future = promise->get_future();
-        future.wait();
+      size_t size() const { return _waiters.size(); }
 
-        return std::move(future.get());
+    private:
+
+      pending_table<sync_waiter*> _waiters;
+    };
+
+    class async_task_manager : public atlas::singleton<async_task_manager> {
+    private:
+
+      // the responses of a task are reduced one by one, the one which finishes the task runs the callback
+      struct pending_task {
+        pending_task(rpc_callback_type cb, int response_expected, rpc_reducer_type reducer)
+          : task(cb, response_expected, reducer), done(false), timer(0) {}
+
+        std::mutex mutex;
+        async_task task;
+        bool done;
+        uint64_t timer; // the timer which expires the task, see timeout_manager
+      };
+
+      typedef std::shared_ptr<pending_task> pending_task_ptr;
+
+    public:
+
+      // register the callback, and return the session id of the call
+      uuid suspend(rpc_callback_type cb, int response_expected = 1, rpc_reducer_type reducer = nullptr) {
+        return _tasks.insert(atlas::make_pooled<pending_task>(cb, response_expected, reducer));
       }
 
-      void resume(const uuid& id, const std::string& result, int err_code = 0) {
-        promise_ptr promise;
+      // remember the timer of the task, it's given back once the task is done
+      void set_timer(const uuid& id, uint64_t timer) {
+        pending_task_ptr p = _tasks.find(id);
+        if (!p) return;
+
+        std::lock_guard<std::mutex> guard(p->mutex);
+        p->timer = timer;
+      }
+
+      /*
+       * The responses coming after the task is done are dropped by the table look up, no user code
+       * runs for them. The callback runs once, out of any lock.
+       *
+       * Return the timer of the task if the response completes it, 0 otherwise.
+       * */
+      uint64_t resume(const uuid& id, const std::string& result, int err_code = 0) {
+        pending_task_ptr p = _tasks.find(id);
+        if (!p) return 0;
 
         {
-          std::lock_guard<std::mutex> guard(_mutex);
-          promise = _promises[id];
-          _promises.erase(id);
+          std::lock_guard<std::mutex> guard(p->mutex);
+          if (p->done) return 0;
+
+          p->task.reduce(result, err_code);
+          if (!p->task.ready()) return 0;
+
+          p->done = true;
         }
 
-        rpc_result r(result, err_code);
-        promise->set_value(r);
-      }
+        _tasks.erase(id);
+        p->task.complete(p->task.err(), &result);
 
-      void clear() {
-        std::lock_guard<std::mutex> guard(_mutex);
-        _promises.clear();
+        return p->timer;
       }
 
-    private:
-
-      std::mutex _mutex;
-      std::map<uuid , promise_ptr> _promises;
-    };
+      // finish the task with an error, whatever the responses it has got
+      void expire(const uuid& id, int err_code) {
+        pending_task_ptr p;
+        if (!_tasks.erase(id, &p)) return;
 
-    class async_task_manager : public atlas::singleton<async_task_manager> {
-    public:
+        {
+          std::lock_guard<std::mutex> guard(p->mutex);
+          if (p->done) return;
 
-      void suspend(const uuid& id, rpc_callback_type cb, int response_received = 1) {
-        std::lock_guard<std::mutex> guard(_mutex);
+          p->done = true;
+        }
 
-        async_task task(cb, response_received);
-        _sessions.insert(std::make_pair(id, task));
+        p->task.complete(err_code);
       }
 
-      void resume(const uuid& id, const std::string& result, int err_code = 0) {
-        std::lock_guard<std::mutex> guard(_mutex);
+      /*
+       * Forget the task, the callback never runs, return false if the task is already done
+       *
+       * The timer of the task is given back if it's cancelled.
+       * */
+      bool cancel(const uuid& id, uint64_t* timer = nullptr) {
+        pending_task_ptr p;
+        if (!_tasks.erase(id, &p)) return false;
 
-        auto it = _sessions.find(id);
-        if (it != _sessions.end()) {
-          // increase response counter
-          it->second.increase_response();
+        std::lock_guard<std::mutex> guard(p->mutex);
+        if (p->done) return false;
 
-          // call callback
-          it->second.run(result, err_code);
+        p->done = true;
+        if (timer) *timer = p->timer;
 
-          // clean if need
-          if (it->second.ready()) {
-            _sessions.erase(it);
-          }
-        }
+        return true;
       }
 
+      void remove(const uuid& id) { _tasks.erase(id); }
+
+      size_t size() const { return _tasks.size(); }
+
     private:
 
-      std::mutex _mutex;
-      std::map<uuid, async_task> _sessions;
+      pending_table<pending_task_ptr> _tasks;
     };
 
   } // rpc
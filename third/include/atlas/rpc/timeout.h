@@ -0,0 +1,186 @@
+/*
+ * timeout.h
+ *
+ *  Created on: Oct 17, 2013
+ *      Author: Vincent Zhang, ivincent.zhang@gmail.com
+ */
+
+/*    Copyright 2011 ~ 2013 Vincent Zhang, ivincent.zhang@gmail.com
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef ATLAS_RPC_TIMEOUT_H_
+#define ATLAS_RPC_TIMEOUT_H_
+
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include <boost/uuid/uuid.hpp>
+
+#include <atlas/singleton.h>
+#include <atlas/timer_wheel.h>
+#include <atlas/rpc/deadline.h>
+#include <atlas/rpc/error.h>
+#include <atlas/rpc/task.h>
+#include <atlas/rpc/stream.h>
+
+namespace atlas {
+  namespace rpc {
+
+    using boost::uuids::uuid;
+
+    /*
+     * Expires the pending async calls whose response does not come in time, the callback gets
+     * errc::timeout. A sync call waits for it's deadline by itself, see sync_waiter.
+     *
+     * Closes the stream receivers idle for too long, see stream_manager::expire_receiver.
+     *
+     * The timer of a call is cancelled when the call completes or is cancelled, so the wheel only
+     * holds the calls in flight, see remote_caller::call_reduce.
+     * */
+    class timeout_manager : public atlas::singleton<timeout_manager> {
+    public:
+
+      // enumerators rather than static constants, std::chrono takes them by reference
+      enum {
+        // the resolution of the timeouts
+        tick_ms = 10,
+
+        // the pending calls without a deadline are expired after this
+        default_timeout_ms = 10 * 60 * 1000
+      };
+
+    private:
+
+      enum entry_kind { pending_call, stream_receiver };
+
+      struct entry {
+        uuid session_id;
+        entry_kind kind;
+      };
+
+    public:
+
+      typedef timer_wheel<entry>::handle timer_handle;
+
+    public:
+
+      timeout_manager() : _wheel(to_tick(deadline_clock::now())), _stopped(false),
+          _thread(&timeout_manager::run, this) {}
+
+      ~timeout_manager() {
+        _stopped = true;
+        if (_thread.joinable()) _thread.join();
+      }
+
+      timeout_manager(const timeout_manager&) = delete;
+      timeout_manager& operator=(const timeout_manager&) = delete;
+
+    public:
+
+      // the pending calls without a deadline are expired after default_timeout_ms
+      static deadline_type expiry_of(const deadline_type& d) {
+        if (d != no_deadline) return d;
+
+        return deadline_clock::now() + std::chrono::milliseconds(default_timeout_ms);
+      }
+
+      // return the timer of the call, to cancel it once the call completes
+      timer_handle schedule(const uuid& session_id, const deadline_type& d) {
+        deadline_type expire = expiry_of(d);
+
+        // round up, a call never expires before it's deadline
+        uint64_t tick = to_tick(expire) + 1;
+
+        std::lock_guard<std::mutex> guard(_mutex);
+        return _wheel.schedule(tick, entry { session_id, pending_call });
+      }
+
+      // nothing happens if the timer has fired already
+      void cancel(timer_handle timer) {
+        std::lock_guard<std::mutex> guard(_mutex);
+        _wheel.cancel(timer);
+      }
+
+      // expire the receiver of the stream once it's idle for stream_manager::stream_timeout_ms
+      void watch_stream(const uuid& session_id) {
+        schedule_stream(session_id, deadline_clock::now() + std::chrono::milliseconds(stream_manager::stream_timeout_ms));
+      }
+
+      size_t size() const {
+        std::lock_guard<std::mutex> guard(_mutex);
+        return _wheel.size();
+      }
+
+    private:
+
+      void schedule_stream(const uuid& session_id, const deadline_type& expire) {
+        uint64_t tick = to_tick(expire) + 1;
+
+        std::lock_guard<std::mutex> guard(_mutex);
+        _wheel.schedule(tick, entry { session_id, stream_receiver });
+      }
+
+      static uint64_t to_tick(const deadline_type& t) {
+        return std::chrono::duration_cast<std::chrono::milliseconds>(t.time_since_epoch()).count() / tick_ms;
+      }
+
+      void run() {
+        std::vector<entry> expired;
+
+        while (!_stopped) {
+          std::this_thread::sleep_for(std::chrono::milliseconds(tick_ms));
+
+          {
+            std::lock_guard<std::mutex> guard(_mutex);
+            _wheel.advance(to_tick(deadline_clock::now()), [&expired](const entry& e) { expired.push_back(e); });
+          }
+
+          // the callbacks run out of the lock
+          for (const auto& e : expired) expire(e);
+
+          expired.clear();
+        }
+      }
+
+      void expire(const entry& e) {
+        if (e.kind == pending_call) {
+          async_task_manager::ref().expire(e.session_id, error_value(errc::timeout));
+          return;
+        }
+
+        // the receiver was active since, watch it again
+        deadline_type next;
+        if (stream_manager::ref().expire_receiver(e.session_id, error_value(errc::timeout), next)) {
+          schedule_stream(e.session_id, next);
+        }
+      }
+
+    private:
+
+      mutable std::mutex _mutex;
+      timer_wheel<entry> _wheel;
+      std::atomic<bool> _stopped;
+
+      // the last member, it starts after everything else is ready
+      std::thread _thread;
+    };
+
+  } // rpc
+} // atlas
+
+#endif /* ATLAS_RPC_TIMEOUT_H_ */
@@ -0,0 +1,126 @@
+/*
+ * waiter.h
+ *
+ *  Created on: Oct 17, 2013
+ *      Author: Vincent Zhang, ivincent.zhang@gmail.com
+ */
+
+/*    Copyright 2011 ~ 2013 Vincent Zhang, ivincent.zhang@gmail.com
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef ATLAS_RPC_WAITER_H_
+#define ATLAS_RPC_WAITER_H_
+
+#include <ctime>
+#include <atomic>
+#include <chrono>
+#include <string>
+
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include <atlas/rpc/deadline.h>
+
+namespace atlas {
+  namespace rpc {
+
+    /*
+     * The thread waiting for the response of a sync call parks on it's own waiter, a futex and a
+     * buffer for the result. There is one waiter per thread, reused by all the sync calls of the
+     * thread, so a call allocates nothing to wait, and the buffer keeps it's capacity.
+     *
+     * The pending call table holds a pointer to the waiter, whoever erases the call from the table
+     * owns it, and notifies the waiter exactly once.
+     * */
+    class sync_waiter {
+    public:
+
+      enum state_type { waiting, notified };
+
+    public:
+
+      sync_waiter() : _state(notified), _err(0) {}
+
+      sync_waiter(const sync_waiter&) = delete;
+      sync_waiter& operator=(const sync_waiter&) = delete;
+
+    public:
+
+      // the waiter of this thread
+      static sync_waiter& local() {
+        static thread_local sync_waiter waiter;
+        return waiter;
+      }
+
+      // prepare for a new call
+      void reset() {
+        _err = 0;
+        _data.clear();
+        _state.store(waiting, std::memory_order_relaxed);
+      }
+
+      void notify(const std::string& data, int err) {
+        _data.assign(data);
+        _err = err;
+
+        _state.store(notified, std::memory_order_release);
+        futex(FUTEX_WAKE_PRIVATE, 1, nullptr);
+      }
+
+      // return false if the deadline passes before the waiter is notified
+      bool wait_until(const deadline_type& d) {
+        while (_state.load(std::memory_order_acquire) == waiting) {
+          if (d == no_deadline) {
+            futex(FUTEX_WAIT_PRIVATE, waiting, nullptr);
+            continue;
+          }
+
+          auto left = std::chrono::duration_cast<std::chrono::nanoseconds>(d - deadline_clock::now()).count();
+          if (left <= 0) return _state.load(std::memory_order_acquire) == notified;
+
+          timespec ts;
+          ts.tv_sec = left / 1000000000;
+          ts.tv_nsec = left % 1000000000;
+          futex(FUTEX_WAIT_PRIVATE, waiting, &ts);
+        }
+
+        return true;
+      }
+
+      void wait() { wait_until(no_deadline); }
+
+      const std::string& data() const { return _data; }
+
+      int err() const { return _err; }
+
+    private:
+
+      // spurious wake ups are fine, the callers check the state in a loop
+      long futex(int op, int value, const timespec* timeout) {
+        return ::syscall(SYS_futex, reinterpret_cast<int*>(&_state), op, value, timeout, nullptr, 0);
+      }
+
+    private:
+
+      std::atomic<int> _state;
+      int _err;
+      std::string _data;
+    };
+
+  } // rpc
+} // atlas
+
+#endif /* ATLAS_RPC_WAITER_H_ */
@@ -11,12 +11,14 @@
 #include <atlas/threadpool/pool.hpp>
 #include <atlas/threadpool/pool_adaptors.hpp>
 #include <atlas/threadpool/task_adaptors.hpp>
+#include <atlas/work_stealing_pool.h>
 
 namespace atlas {
 
   typedef boostplus::threadpool::fifo_pool fifo_thread_pool;
   typedef boostplus::threadpool::lifo_pool lifo_thread_pool;
   typedef boostplus::threadpool::prio_pool prio_thread_pool;
+  typedef work_stealing_pool stealing_thread_pool;
 
 } // atlas
 
@@ -0,0 +1,257 @@
+/*
+ * timer_wheel.h
+ *
+ *  Created on: Oct 17, 2013
+ *      Author: Vincent Zhang, ivincent.zhang@gmail.com
+ */
+
+/*    Copyright 2011 ~ 2013 Vincent Zhang, ivincent.zhang@gmail.com
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef ATLAS_TIMER_WHEEL_H_
+#define ATLAS_TIMER_WHEEL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+namespace atlas {
+
+  /*
+   * A hierarchical timer wheel, the time is counted in ticks.
+   *
+   * The first level has 256 slots of one tick, every next level has 64 slots, each of them covers
+   * a whole turn of the level below it. A timer is put into the lowest level which can hold it,
+   * and moves down a level every time the level below completes a turn, so scheduling, cancelling
+   * and firing a timer are all O(1). Timers beyond the last level wait in an overflow list.
+   *
+   * The timers live in a single array, the slots are lists linked by the indexes of the array, and
+   * a timer fired or cancelled goes to a free list, so the array holds as many timers as were ever
+   * pending at once, and a timer allocates nothing once the array has grown to that.
+   *
+   * A handle names a timer until it fires or is cancelled, a stale handle cancels nothing.
+   *
+   * Not thread safe.
+   * */
+  template<typename Entry>
+  class timer_wheel {
+  public:
+
+    static const int root_bits = 8;
+    static const int level_bits = 6;
+    static const int levels = 4;
+
+    // never a handle of a timer
+    static const uint64_t no_timer = 0;
+
+    typedef uint64_t handle;
+
+  private:
+
+    static const uint64_t root_size = 1 << root_bits;
+    static const uint64_t level_size = 1 << level_bits;
+
+    // every slot, the overflow list included, is the head of a circular list at the front of the array
+    static const uint32_t slot_count = root_size + (levels - 1) * level_size + 1;
+    static const uint32_t overflow_slot = slot_count - 1;
+
+    static const uint32_t no_node = UINT32_MAX;
+
+    struct node {
+      uint64_t expire;
+      Entry entry;
+      uint32_t prev;
+      uint32_t next; // the next free node once the node is free
+      uint32_t generation; // changes every time the node is freed
+    };
+
+  public:
+
+    timer_wheel(uint64_t now = 0) : _now(now), _size(0), _free(no_node), _nodes(slot_count) {
+      for (uint32_t i = 0; i < slot_count; ++i) {
+        _nodes[i].prev = i;
+        _nodes[i].next = i;
+      }
+    }
+
+  public:
+
+    // the timer fires once the wheel is advanced to the expire tick, a tick in the past fires on the next tick
+    handle schedule(uint64_t expire, const Entry& entry) {
+      uint32_t index = allocate();
+
+      node& n = _nodes[index];
+      n.expire = expire > _now ? expire : _now + 1;
+      n.entry = entry;
+
+      place(index);
+      ++_size;
+
+      return (static_cast<uint64_t>(n.generation) << 32) | index;
+    }
+
+    // the timer never fires, return false if it's fired or cancelled already
+    bool cancel(handle h) {
+      uint32_t index = static_cast<uint32_t>(h);
+      if (index < slot_count || index >= _nodes.size()) return false;
+
+      node& n = _nodes[index];
+      if (n.generation != static_cast<uint32_t>(h >> 32) || n.prev == no_node) return false;
+
+      unlink(index);
+      release(index);
+      --_size;
+
+      return true;
+    }
+
+    // fire every timer expired by the tick, the handler may schedule or cancel other timers
+    template<typename Handler>
+    void advance(uint64_t tick, Handler on_expire) {
+      while (_now < tick) {
+        ++_now;
+
+        cascade();
+
+        // a timer scheduled by the handler is never put into the current slot
+        uint32_t slot = _now & (root_size - 1);
+        while (_nodes[slot].next != slot) {
+          uint32_t index = _nodes[slot].next;
+
+          unlink(index);
+          Entry entry = _nodes[index].entry;
+          release(index);
+          --_size;
+
+          on_expire(entry);
+        }
+      }
+    }
+
+    uint64_t now() const { return _now; }
+
+    size_t size() const { return _size; }
+
+    bool empty() const { return _size == 0; }
+
+  private:
+
+    uint32_t allocate() {
+      if (_free == no_node) {
+        node n;
+        n.generation = 1;
+        _nodes.push_back(n);
+
+        return static_cast<uint32_t>(_nodes.size() - 1);
+      }
+
+      uint32_t index = _free;
+      _free = _nodes[index].next;
+
+      return index;
+    }
+
+    void release(uint32_t index) {
+      node& n = _nodes[index];
+
+      ++n.generation;
+      n.prev = no_node;
+      n.next = _free;
+      _free = index;
+    }
+
+    void link(uint32_t slot, uint32_t index) {
+      node& n = _nodes[index];
+
+      n.prev = _nodes[slot].prev;
+      n.next = slot;
+      _nodes[n.prev].next = index;
+      _nodes[slot].prev = index;
+    }
+
+    void unlink(uint32_t index) {
+      node& n = _nodes[index];
+
+      _nodes[n.prev].next = n.next;
+      _nodes[n.next].prev = n.prev;
+    }
+
+    // the timer is not expired before the current tick, the current slot is fired after cascading
+    void place(uint32_t index) {
+      uint64_t expire = _nodes[index].expire;
+      uint64_t delta = expire - _now;
+
+      if (delta < root_size) {
+        link(expire & (root_size - 1), index);
+        return;
+      }
+
+      for (int level = 0; level < levels - 1; ++level) {
+        int shift = root_bits + level * level_bits;
+
+        if (delta < (root_size << ((level + 1) * level_bits))) {
+          link(root_size + level * level_size + ((expire >> shift) & (level_size - 1)), index);
+          return;
+        }
+      }
+
+      link(overflow_slot, index);
+    }
+
+    // move down the timers of the upper levels, whose turn has come
+    void cascade() {
+      if (_now & (root_size - 1)) return;
+
+      for (int level = 0; level < levels - 1; ++level) {
+        int shift = root_bits + level * level_bits;
+        uint64_t index = (_now >> shift) & (level_size - 1);
+
+        replace(root_size + level * level_size + index);
+
+        if (index) return;
+      }
+
+      replace(overflow_slot);
+    }
+
+    // detach the list of the slot first, a timer might go back into the same slot
+    void replace(uint32_t slot) {
+      uint32_t index = _nodes[slot].next;
+
+      _nodes[slot].prev = slot;
+      _nodes[slot].next = slot;
+
+      while (index != slot) {
+        uint32_t next = _nodes[index].next;
+        place(index);
+        index = next;
+      }
+    }
+
+  private:
+
+    uint64_t _now;
+    size_t _size;
+
+    // the head of the free list
+    uint32_t _free;
+
+    // the slot heads, then the timers
+    std::vector<node> _nodes;
+  };
+
+} // atlas
+
+#endif /* ATLAS_TIMER_WHEEL_H_ */
@@ -0,0 +1,481 @@
+/*
+ * work_stealing_pool.h
+ *
+ *  Created on: Oct 17, 2013
+ *      Author: Vincent Zhang, ivincent.zhang@gmail.com
+ */
+
+/*    Copyright 2011 ~ 2013 Vincent Zhang, ivincent.zhang@gmail.com
+ *
+ *    Licensed under the Apache License, Version 2.0 (the "License");
+ *    you may not use this file except in compliance with the License.
+ *    You may obtain a copy of the License at
+ *
+ *    http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *    Unless required by applicable law or agreed to in writing, software
+ *    distributed under the License is distributed on an "AS IS" BASIS,
+ *    WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *    See the License for the specific language governing permissions and
+ *    limitations under the License.
+ */
+
+#ifndef ATLAS_WORK_STEALING_POOL_H_
+#define ATLAS_WORK_STEALING_POOL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <mutex>
+#include <deque>
+#include <memory>
+#include <vector>
+#include <thread>
+#include <chrono>
+#include <utility>
+#include <functional>
+#include <condition_variable>
+
+namespace atlas {
+
+  /*
+   * A thread pool with a task queue per worker, so the threads scheduling tasks do not fight
+   * for a single lock : a worker schedules into it's own queue, any other thread into the queue
+   * of a worker it sticks to, and the threads are spread over the workers. A worker runs the
+   * tasks of it's own queue in order, and once it runs dry, it steals from the other queues,
+   * starting from a random one. A worker with nothing to steal spins for a while, and then parks
+   * until a task is scheduled.
+   *
+   * A task is scheduled with a priority level, 0 is the highest one : the workers run the highest
+   * level waiting in any queue first. A task which waits longer than the aging time in a lower
+   * level is run before the higher levels of it's queue, so no level starves.
+   *
+   * The interface is the one of fifo_thread_pool, but the order of the tasks is kept within
+   * a queue and a level only. The pool grows and never shrinks, it's threads live as long as
+   * the pool.
+   *
+   * A task must not throw an exception.
+   * */
+  class work_stealing_pool {
+  public:
+
+    typedef std::function<void()> task_type;
+
+    // called with the index of the worker
+    typedef std::function<void(size_t)> thread_init_type;
+
+    typedef std::chrono::steady_clock clock_type;
+
+    enum priority_type { high_priority = 0, normal_priority, low_priority, priority_levels };
+
+    static const size_t max_threads = 256;
+
+    // the rounds a worker looks for a task before it parks
+    static const int spin_rounds = 64;
+
+  private:
+
+    struct queued_task {
+      task_type task;
+      clock_type::time_point enqueued;
+    };
+
+    struct worker_queue {
+      worker_queue() : size(0) {}
+
+      std::mutex mutex;
+      std::deque<queued_task> tasks[priority_levels];
+      std::atomic<size_t> size;
+
+      // keep the queues of the workers in their own cache lines
+      char padding[64];
+    };
+
+    // the worker the current thread is, if any
+    struct worker_identity {
+      const work_stealing_pool* pool;
+      size_t index;
+    };
+
+  public:
+
+    // the pool grows on resize() only, so it's own threads are never counted twice
+    class size_controller_type {
+    public:
+
+      size_controller_type(work_stealing_pool& pool) : _pool(pool) {}
+
+      bool resize(size_t worker_count) { return _pool.resize(worker_count); }
+
+    private:
+
+      work_stealing_pool& _pool;
+    };
+
+  public:
+
+    work_stealing_pool(size_t initial_threads = 1) :
+      _size(0), _next_home(0), _pending(0), _active(0), _sleepers(0), _stopping(false),
+      _aging(std::chrono::milliseconds(20)), _init_version(0)
+    {
+      for (auto& q : _queues) q.store(nullptr, std::memory_order_relaxed);
+      for (auto& n : _level_pending) n = 0;
+
+      resize(initial_threads);
+    }
+
+    // run the tasks already scheduled, and join the workers
+    ~work_stealing_pool() {
+      {
+        std::lock_guard<std::mutex> guard(_park_mutex);
+        _stopping = true;
+        _task_event.notify_all();
+      }
+
+      for (auto& t : _threads) t.join();
+
+      for (auto& q : _queues) delete q.load(std::memory_order_relaxed);
+    }
+
+    work_stealing_pool(const work_stealing_pool&) = delete;
+    work_stealing_pool& operator=(const work_stealing_pool&) = delete;
+
+  public:
+
+    size_controller_type size_controller() { return size_controller_type(*this); }
+
+    // add workers up to worker_count, return false if the pool can not grow to it
+    bool resize(size_t worker_count) {
+      std::lock_guard<std::mutex> guard(_resize_mutex);
+
+      if (_stopping || worker_count > max_threads) return false;
+
+      size_t size = _size.load(std::memory_order_relaxed);
+      if (worker_count < size) return false;
+
+      for (size_t i = size; i < worker_count; ++i) {
+        _queues[i].store(new worker_queue(), std::memory_order_release);
+        _size.store(i + 1, std::memory_order_release);
+
+        _threads.push_back(std::thread(std::bind(&work_stealing_pool::run, this, i)));
+      }
+
+      return true;
+    }
+
+    size_t size() const { return _size.load(std::memory_order_acquire); }
+
+    bool schedule(const task_type& task, int priority = normal_priority) {
+      return push(task_type(task), priority);
+    }
+
+    bool schedule(task_type&& task, int priority = normal_priority) {
+      return push(std::move(task), priority);
+    }
+
+    // set before the tasks are scheduled
+    void set_aging(std::chrono::microseconds aging) { _aging = aging; }
+
+    // every worker runs init once, the workers already started included, to pin itself to a core
+    // for example, the parked workers are woken up for it
+    void set_thread_init(const thread_init_type& init) {
+      {
+        std::lock_guard<std::mutex> guard(_resize_mutex);
+
+        _thread_init = std::make_shared<const thread_init_type>(init);
+        ++_init_version;
+      }
+
+      std::lock_guard<std::mutex> guard(_park_mutex);
+      _task_event.notify_all();
+    }
+
+    // the number of tasks which are running
+    size_t active() const { return _active.load(); }
+
+    // the number of tasks which wait in the queues
+    size_t pending_tasks() const { return _pending.load(); }
+
+    bool empty() const { return _pending.load() == 0; }
+
+    // drop the tasks which wait in the queues
+    void clear() {
+      size_t size = this->size();
+      for (size_t i = 0; i < size; ++i) {
+        worker_queue& q = queue(i);
+
+        std::deque<queued_task> dropped[priority_levels];
+        {
+          std::lock_guard<std::mutex> guard(q.mutex);
+          for (int level = 0; level < priority_levels; ++level) {
+            dropped[level].swap(q.tasks[level]);
+            _level_pending[level] -= dropped[level].size();
+            _pending -= dropped[level].size();
+          }
+
+          q.size.store(0);
+        }
+      }
+    }
+
+    // block until the number of the running and the waiting tasks is task_threshold or less
+    void wait(size_t task_threshold = 0) const {
+      std::unique_lock<std::mutex> lock(_park_mutex);
+      while (_active.load() + _pending.load() > task_threshold) {
+        _idle_event.wait_for(lock, std::chrono::milliseconds(1));
+      }
+    }
+
+    template<typename Duration>
+    bool wait(const Duration& timeout, size_t task_threshold = 0) const {
+      auto deadline = std::chrono::steady_clock::now() + timeout;
+
+      std::unique_lock<std::mutex> lock(_park_mutex);
+      while (_active.load() + _pending.load() > task_threshold) {
+        if (std::chrono::steady_clock::now() >= deadline) return false;
+
+        _idle_event.wait_for(lock, std::chrono::milliseconds(1));
+      }
+
+      return true;
+    }
+
+  private:
+
+    static worker_identity& current_worker() {
+      static thread_local worker_identity identity = { nullptr, 0 };
+      return identity;
+    }
+
+    worker_queue& queue(size_t index) const {
+      return *_queues[index].load(std::memory_order_acquire);
+    }
+
+    // a worker pushes into it's own queue, any other thread into the queue it was given first
+    size_t home_of_current_thread() {
+      const worker_identity& self = current_worker();
+      if (self.pool == this) return self.index;
+
+      static thread_local const work_stealing_pool* pool = nullptr;
+      static thread_local size_t home = 0;
+
+      if (pool != this) {
+        pool = this;
+        home = _next_home++;
+      }
+
+      return home % size();
+    }
+
+    bool push(task_type&& task, int priority) {
+      if (_stopping || size() == 0) return false;
+
+      int level = priority < 0 ? 0 : (priority < priority_levels ? priority : priority_levels - 1);
+
+      // counted before a worker can take it
+      ++_pending;
+
+      worker_queue& q = queue(home_of_current_thread());
+      {
+        std::lock_guard<std::mutex> guard(q.mutex);
+        q.tasks[level].push_back(queued_task { std::move(task), clock_type::now() });
+        ++_level_pending[level];
+        q.size.fetch_add(1);
+      }
+
+      // pairs with the check of a worker going to park : either it sees the task, or we see it
+      if (_sleepers.load() > 0) {
+        std::lock_guard<std::mutex> guard(_park_mutex);
+        _task_event.notify_one();
+      }
+
+      return true;
+    }
+
+    // the highest level waiting in any queue
+    int top_level() const {
+      for (int level = 0; level < priority_levels; ++level) {
+        if (_level_pending[level].load() > 0) return level;
+      }
+
+      return priority_levels;
+    }
+
+    // the caller holds the lock of the queue
+    void pop_locked(worker_queue& q, int level, task_type& task) {
+      task = std::move(q.tasks[level].front().task);
+      q.tasks[level].pop_front();
+
+      --_level_pending[level];
+      q.size.fetch_sub(1);
+    }
+
+    // the task of the level
+    bool pop(worker_queue& q, int level, task_type& task) {
+      if (q.size.load(std::memory_order_relaxed) == 0) return false;
+
+      std::lock_guard<std::mutex> guard(q.mutex);
+      if (q.tasks[level].empty()) return false;
+
+      pop_locked(q, level, task);
+      return true;
+    }
+
+    // the oldest aged task of the own queue, or the highest one unless a higher level waits in another queue
+    bool pop_own(worker_queue& q, int top, task_type& task) {
+      if (q.size.load(std::memory_order_relaxed) == 0) return false;
+
+      std::lock_guard<std::mutex> guard(q.mutex);
+
+      clock_type::time_point aged = clock_type::now() - _aging;
+      int oldest = -1;
+      for (int level = 1; level < priority_levels; ++level) {
+        if (q.tasks[level].empty() || q.tasks[level].front().enqueued > aged) continue;
+
+        if (oldest < 0 || q.tasks[level].front().enqueued < q.tasks[oldest].front().enqueued) oldest = level;
+      }
+
+      if (oldest > 0) {
+        pop_locked(q, oldest, task);
+        return true;
+      }
+
+      for (int level = 0; level <= top && level < priority_levels; ++level) {
+        if (!q.tasks[level].empty()) {
+          pop_locked(q, level, task);
+          return true;
+        }
+      }
+
+      return false;
+    }
+
+    // the own queue first, then the others from a random one on, level by level
+    bool take(size_t index, uint64_t& seed, task_type& task) {
+      int top = top_level();
+      if (top == priority_levels) return false;
+
+      if (pop_own(queue(index), top, task)) return true;
+
+      size_t size = this->size();
+
+      // xorshift
+      seed ^= seed << 13;
+      seed ^= seed >> 7;
+      seed ^= seed << 17;
+
+      size_t first = seed % size;
+      for (int level = top; level < priority_levels; ++level) {
+        if (_level_pending[level].load() == 0) continue;
+
+        for (size_t i = 0; i < size; ++i) {
+          size_t victim = (first + i) % size;
+          if (pop(queue(victim), level, task)) return true;
+        }
+      }
+
+      return false;
+    }
+
+    bool has_task() const {
+      size_t size = this->size();
+      for (size_t i = 0; i < size; ++i) {
+        if (queue(i).size.load() > 0) return true;
+      }
+
+      return false;
+    }
+
+    // return false if the pool is stopping and there is nothing left to do
+    bool park(size_t init_version) {
+      std::unique_lock<std::mutex> lock(_park_mutex);
+
+      ++_sleepers;
+
+      bool stop = false;
+      if (!has_task() && _init_version.load() == init_version) {
+        if (_stopping) {
+          stop = true;
+        }
+        else {
+          _idle_event.notify_all();
+          _task_event.wait(lock);
+        }
+      }
+
+      --_sleepers;
+
+      return !stop;
+    }
+
+    void init_thread(size_t index, size_t& init_version) {
+      std::shared_ptr<const thread_init_type> init;
+      {
+        std::lock_guard<std::mutex> guard(_resize_mutex);
+        init = _thread_init;
+        init_version = _init_version.load();
+      }
+
+      if (init && *init) (*init)(index);
+    }
+
+    void run(size_t index) {
+      current_worker() = worker_identity { this, index };
+
+      uint64_t seed = 0x9e3779b97f4a7c15ULL * (index + 1);
+      task_type task;
+      size_t init_version = 0;
+
+      while (true) {
+        if (_init_version.load(std::memory_order_acquire) != init_version) init_thread(index, init_version);
+
+        bool found = false;
+        for (int round = 0; round < spin_rounds && !found; ++round) {
+          found = take(index, seed, task);
+          if (!found && round >= spin_rounds / 2) std::this_thread::yield();
+        }
+
+        if (!found) {
+          if (!park(init_version)) return;
+          continue;
+        }
+
+        ++_active;
+        --_pending;
+
+        task();
+        task = nullptr;
+
+        --_active;
+      }
+    }
+
+  private:
+
+    std::atomic<worker_queue*> _queues[max_threads];
+    std::atomic<size_t> _size;
+    std::atomic<size_t> _next_home;
+
+    std::atomic<size_t> _pending;
+    std::atomic<size_t> _level_pending[priority_levels];
+    std::atomic<size_t> _active;
+
+    std::atomic<size_t> _sleepers;
+    std::atomic<bool> _stopping;
+
+    clock_type::duration _aging;
+
+    mutable std::mutex _park_mutex;
+    std::condition_variable _task_event; // a task is scheduled, or the pool is stopping
+    mutable std::condition_variable _idle_event; // a worker runs out of tasks
+
+    std::mutex _resize_mutex;
+    std::vector<std::thread> _threads;
+
+    std::atomic<size_t> _init_version;
+    std::shared_ptr<const thread_init_type> _thread_init;
+  };
+
+} // atlas
+
+#endif /* ATLAS_WORK_STEALING_POOL_H_ */